@@ -8,13 +8,41 @@
  */
 
 #include <linux/cleanup.h>
+#include <linux/debugfs.h>
 #include <linux/errno.h>
+#include <linux/fault-inject.h>
+#include <linux/hrtimer.h>
+#include <linux/idr.h>
 #include <linux/input.h>
+#include <linux/jump_label.h>
 #include <linux/kernel.h>
+#include <linux/kfifo.h>
+#include <linux/kref.h>
+#include <linux/list.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
+#include <linux/platform_device.h>
+#include <linux/poll.h>
+#include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/seqlock.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#include <asm/unaligned.h>
+
+#include "hori_uapi.h"
+
+#define HORI_EMIT(input, type, code, value) input_event(input, type, code, value)
+#include "hori_report.h"
+
+#define CREATE_TRACE_POINTS
+#include "hori_trace.h"
 
 #include <linux/usb.h>
 #include <linux/usb/input.h>
@@ -22,71 +50,304 @@
 #define HORI_VENDOR_ID		0x06d3
 #define HORI_PRODUCT_ID		0x0f10
 
-#define HORI_POLL_VR0		0x00
-#define HORI_POLL_VR1		0x01
-
-/* input: vendor request 0x00 */
-struct hori_raw_input_vr_00 {
-    u8 fire_c : 1;           /* button fire-c */
-    u8 button_d : 1;         /* button D */
-    u8 hat : 1;              /* hat press */
-    u8 button_st : 1;        /* button ST */
-
-    u8 dpad1_top : 1;        /* d-pad 1 top */
-    u8 dpad1_right : 1;      /* d-pad 1 right */
-    u8 dpad1_bottom : 1;     /* d-pad 1 bottom */
-    u8 dpad1_left : 1;       /* d-pad 1 left */
-
-    u8 reserved1 : 1;
-    u8 reserved2 : 1;
-    u8 reserved3 : 1;
-    u8 reserved4 : 1;
-
-    u8 reserved5 : 1;
-    u8 launch : 1;           /* button lauch */
-    u8 trigger : 1;          /* trigger */
-    u8 reserved6 : 1;
+#define HORI_VR_MASK		GENMASK(HORI_VR_COUNT - 1, 0)
+
+/* Frame sources; the VR ones match the request numbers */
+#define HORI_FRAME_VR0		HORI_POLL_VR0
+#define HORI_FRAME_VR1		HORI_POLL_VR1
+#define HORI_FRAME_IRQ		2
+#define HORI_FRAME_SOURCES	3
+
+#define HORI_IRQ_URBS_MAX	4
+#define HORI_IRQ_INTERVAL_MAX	255
+#define HORI_RING_MAX		(1U << 20)
+#define HORI_RAW_FRAMES_MAX	16384	/* 512 KiB per reader */
+#define HORI_STREAM_READERS_MAX	8
+#define HORI_REPLAY_BUF		4096
+
+/* Soft expiry, so the poll timer submits from softirq like a URB completion */
+#define HORI_POLL_TIMER_MODE	HRTIMER_MODE_REL_SOFT
+
+/* Highest control poll rate we allow; each cycle is two control transfers */
+#define HORI_POLL_RATE_MAX	2000
+
+/* Retry backoff after a failed transfer: 1, 2, 4 ... ms, at most a second */
+#define HORI_RETRY_MIN_MS	1
+#define HORI_RETRY_MAX_MS	1000
+
+/* irq_parked: bit n is URB n waiting for a retry, plus this one */
+#define HORI_IRQ_HALTED		HORI_IRQ_URBS_MAX
+
+/* Shortest stall the watchdog acts on, for back-to-back and fast polling */
+#define HORI_WATCHDOG_MIN_MS	50U
+
+static unsigned int poll_rate = 500;
+module_param(poll_rate, uint, 0444);
+MODULE_PARM_DESC(poll_rate, "Button poll cycles per second, 0 = back-to-back (default 500)");
+
+static unsigned int irq_urbs = 2;
+module_param(irq_urbs, uint, 0444);
+MODULE_PARM_DESC(irq_urbs, "Interrupt URBs kept in flight, 1-4 (default 2)");
+
+static unsigned int irq_interval;
+module_param(irq_interval, uint, 0444);
+MODULE_PARM_DESC(irq_interval, "Interrupt endpoint polling interval in bInterval units (ms on this full-speed stick), 0 = device default; ignored by xHCI hosts");
+
+static unsigned int ring_size = 16384;
+module_param(ring_size, uint, 0444);
+MODULE_PARM_DESC(ring_size, "Raw capture ring entries, power of two, 0 = off (default 16384)");
+
+static unsigned int raw_frames = 1024;
+module_param(raw_frames, uint, 0444);
+MODULE_PARM_DESC(raw_frames, "Frames buffered per /dev/hori-raw reader, power of two, 2-16384 (default 1024)");
+
+static bool virtual_stick;
+module_param(virtual_stick, bool, 0444);
+MODULE_PARM_DESC(virtual_stick, "Add a stick without hardware, fed by debugfs replay (default false)");
+
+static unsigned int watchdog = 10;
+module_param(watchdog, uint, 0644);
+MODULE_PARM_DESC(watchdog, "Restart button polling after this many poll periods without a completion, 0 = off (default 10)");
+
+static bool frame_mode = true;
+module_param(frame_mode, bool, 0644);
+MODULE_PARM_DESC(frame_mode, "Merge axes, VR0 and VR1 into one input_sync per frame (default true)");
+
+/*
+ * Per-transfer dumps for debugging, off by default. The branches are
+ * patched in and out when the parameter changes, so while it is off
+ * they cost a NOP in the completion handlers.
+ */
+static DEFINE_STATIC_KEY_FALSE(hori_debug_key);
+static bool debug;
+
+static int hori_debug_set(const char *val, const struct kernel_param *kp)
+{
+	int error;
+
+	error = param_set_bool(val, kp);
+	if (error)
+		return error;
+
+	if (debug)
+		static_branch_enable(&hori_debug_key);
+	else
+		static_branch_disable(&hori_debug_key);
+
+	return 0;
+}
+
+static const struct kernel_param_ops hori_debug_ops = {
+	.set = hori_debug_set,
+	.get = param_get_bool,
+};
+module_param_cb(debug, &hori_debug_ops, &debug, 0644);
+MODULE_PARM_DESC(debug, "Log every transfer (default false)");
+
+#define hori_debug(hori, fmt, ...)					\
+do {									\
+	if (static_branch_unlikely(&hori_debug_key))			\
+		dev_info((hori)->dev, fmt, ##__VA_ARGS__);		\
+} while (0)
+
+/*
+ * Log2 latency histograms, one set per frame source. Bucket n counts
+ * samples below 2^n ns, the last one everything above.
+ */
+enum hori_hist_type {
+	HORI_HIST_RTT,		/* submit to completion */
+	HORI_HIST_GAP,		/* completion to next completion */
+	HORI_HIST_SYNC,		/* completion to the input_sync that carried it */
+	HORI_HIST_RECOVER,	/* injected fault to the next good transfer */
+	HORI_HIST_TYPES
+};
+
+#define HORI_HIST_BUCKETS	32
+
+struct hori_hist {
+	atomic64_t		bucket[HORI_HIST_TYPES][HORI_HIST_BUCKETS];
+	ktime_t			last;	/* previous completion */
+	ktime_t			fault;	/* first fault not recovered from */
+};
+
+/* What hori_fault() may do to a completion, one bit each in fault_kinds */
+enum hori_fault_kind {
+	HORI_FAULT_EPROTO,
+	HORI_FAULT_ETIME,
+	HORI_FAULT_EPIPE,
+	HORI_FAULT_SHORT,	/* status 0, half the data */
+	HORI_FAULT_KINDS
+};
+
+/*
+ * Frame stream behind /dev/hori-raw<id>. It is refcounted apart from
+ * struct hori because open readers may outlive the stick; the last one
+ * frees it. Each reader has its own kfifo, filled under lock from
+ * hori_frame_flush() and drained without it by that reader only.
+ */
+struct hori_stream {
+	struct kref		kref;
+	struct miscdevice	misc;
+	char			name[16];
+	spinlock_t		lock;	/* readers; nests in frame_lock */
+	struct list_head	readers;
+	unsigned int		nr_readers;	/* under lock */
+	wait_queue_head_t	wait;
+	u32			seq;	/* next frame, under frame_lock */
+	bool			dead;	/* stick gone */
+};
+
+struct hori_stream_reader {
+	struct hori_stream	*stream;
+	struct list_head	node;
+	struct mutex		read_mutex;
+	struct hori_frame_record *buf;	/* kvmalloc'ed behind fifo */
+	DECLARE_KFIFO_PTR(fifo, struct hori_frame_record);
+};
+
+/*
+ * Overwriting capture ring of raw transfers, read through debugfs. Any
+ * completion handler may write concurrently: a writer claims a sequence
+ * number with one atomic increment and publishes the slot by storing
+ * that number in commit. While the slot is being filled commit holds
+ * seq - 1, so a reader can tell a slot that isn't written yet or got
+ * overwritten under it from a good one.
+ */
+struct hori_ring_slot {
+	u32			commit;
+	struct hori_raw_record	rec;
+};
+
+struct hori_ring {
+	atomic_t		head;	/* next sequence number */
+	u32			mask;
+	bool			dead;	/* device is going away */
+	wait_queue_head_t	wait;
+	struct hori_ring_slot	slots[];
+};
+
+/* Counters exported in the statistics sysfs group */
+enum hori_stat {
+	HORI_STAT_IRQ_REPORTS,		/* interrupt reports received */
+	HORI_STAT_VR0_POLLS,		/* VR0 requests completed */
+	HORI_STAT_VR1_POLLS,		/* VR1 requests completed */
+	HORI_STAT_ERR_ETIME,		/* completion status counters */
+	HORI_STAT_ERR_EPIPE,
+	HORI_STAT_ERR_EPROTO,
+	HORI_STAT_ERR_EILSEQ,
+	HORI_STAT_ERR_EOVERFLOW,
+	HORI_STAT_ERR_SHUTDOWN,		/* ECONNRESET, ENOENT, ESHUTDOWN */
+	HORI_STAT_ERR_OTHER,
+	HORI_STAT_SUBMIT_ERRORS,	/* failed usb_submit_urb() */
+	HORI_STAT_RETRIES,		/* retries scheduled after an error */
+	HORI_STAT_HALTS_CLEARED,	/* interrupt endpoint halts cleared */
+	HORI_STAT_RECOVERIES,		/* good transfers after failed ones */
+	HORI_STAT_WATCHDOG_RESTARTS,	/* stalled poll chains restarted */
+	HORI_STAT_FAULTS_INJECTED,	/* completions hori_fault() changed */
+	HORI_STAT_EVENTS,		/* input events emitted */
+	HORI_STAT_SYNCS,		/* input_sync() calls */
+	HORI_STAT_COUNT
+};
+
+/* Latest state from every source, reported together with one input_sync */
+struct hori_frame {
+	unsigned long		dirty;	/* HORI_FRAME_* sources not reported yet */
+	ktime_t			stamp[HORI_FRAME_SOURCES];	/* completion */
+	u8			report[HORI_IRQ_REPORT_LEN];
+	__le16			vr[HORI_VR_COUNT];
+};
+
+struct hori;
+
+/* One interrupt URB of the queue kept on the endpoint */
+struct hori_irq {
+	struct hori		*hori;
+	struct urb		*urb;
+	u8			*buf;
+	dma_addr_t		dma;
+	u32			seq;	/* submission order */
+	ktime_t			submitted;
 };
 
-/* input: vendor request 0x01 */
-struct hori_raw_input_vr_01 {
-    u8 reserved1 : 1;
-    u8 reserved2 : 1;
-    u8 reserved3 : 1;
-    u8 reserved4 : 1;
-
-    u8 dpad3_right : 1;      /* d-pad 3 right */
-    u8 dpad3_middle : 1;     /* d-pad 3 middle */
-    u8 dpad3_left : 1;       /* d-pad 3 left */
-    u8 reserved5 : 1;
-
-    u8 mode_select : 2;      /* mode select (M1 - M2 - M3, 2 - 1 - 3) */
-    u8 reserved6 : 1;
-    u8 button_sw1 : 1;       /* button sw-1 */
-
-    u8 dpad2_top : 1;        /* d-pad 2 top */
-    u8 dpad2_right : 1;      /* d-pad 2 right */
-    u8 dpad2_bottom : 1;     /* d-pad 2 bottom */
-    u8 dpad2_left : 1;       /* d-pad 2 left */
+/* One vendor request pipeline; VR0 and VR1 each have their own */
+struct hori_ctl {
+	struct hori		*hori;
+	struct urb		*urb;
+	struct usb_ctrlrequest	*req;
+	u8			vr;	/* HORI_POLL_VR0 or HORI_POLL_VR1 */
+	ktime_t			submitted;
+	ktime_t			completed;	/* for the watchdog */
+	struct delayed_work	retry;
+	unsigned int		retries;	/* failures since the last success */
 };
 
 struct hori {
 	struct input_dev	*input;
-	struct usb_interface	*intf;
+	struct device		*dev;	/* interface, or the virtual stick */
+	struct usb_interface	*intf;	/* NULL on the virtual stick */
 	struct usb_endpoint_descriptor *epirq;
-	struct urb		*urb, *urb_ctl;
+	struct hori_irq		irq[HORI_IRQ_URBS_MAX];
+	unsigned int		irq_count;
+	struct usb_anchor	irq_anchor;
+	atomic_t		irq_seq;	/* next to submit */
+	u32			irq_next_seq;	/* next expected to complete */
+	unsigned long		irq_reordered;	/* completions out of order */
+	unsigned int		irq_interval;	/* override, 0 = bInterval */
+	ktime_t			irq_window;	/* start of rate window */
+	unsigned int		irq_window_reports;
+	unsigned int		irq_rate;	/* reports/s, last window */
+	bool			irq_running;
+	bool			irq_clearing;	/* unlinking to clear a halt */
+	unsigned long		irq_parked;	/* URBs waiting for irq_retry */
+	struct delayed_work	irq_retry;
+	unsigned int		irq_retries;	/* failures since the last success */
+	struct hori_ctl		ctl[HORI_VR_COUNT];
 	struct mutex		pm_mutex;
 	bool			is_open;
+	struct hrtimer		poll_timer;
+	unsigned int		poll_rate;
+	unsigned long		flags;	/* bit n: VRn request in flight */
+	unsigned long		vr_backoff;	/* bit n: VRn waiting to retry */
+	bool			polling;
+	struct delayed_work	watchdog;
+	spinlock_t		frame_lock;
+	struct hori_frame	frame;
 	char			phys[64];
-	struct usb_ctrlrequest	*ctl_req;
-	struct hori_raw_input_vr_00 vr0;
-	struct hori_raw_input_vr_01 vr1;
+	struct dentry		*debugfs;
+	struct hori_hist	hist[HORI_FRAME_SOURCES];
+	atomic_long_t		stats[HORI_STAT_COUNT];
+	struct hori_ring	*ring;
+#ifdef CONFIG_FAULT_INJECTION_DEBUG_FS
+	struct fault_attr	fault;
+	u32			fault_kinds;	/* BIT(HORI_FAULT_*) */
+#endif
+	u32			replay_speed;	/* 0 = flat out, 1 = real time */
+	struct hori_decoder	dec;	/* under frame_lock */
+	seqcount_spinlock_t	state_seq;	/* writers hold frame_lock */
+	struct hori_state	state;
+	struct page		*shm_page;	/* mapped by /dev/hori<id> */
+	struct hori_shm		*shm;	/* under frame_lock */
+	struct miscdevice	misc;
+	int			id;
+	char			misc_name[16];
+	struct hori_stream	*stream;
+	u64			irq_prev;	/* last interrupt report */
+	bool			irq_prev_valid;
+	unsigned long		irq_suppressed;	/* repeats not reported */
+
+	/* DMA-coherent transfer buffers */
+	size_t			irq_len;
+	__le16			*vr;	/* one word per request */
+	dma_addr_t		vr_dma;
 };
 
 #define ERRCASE(CODE) case -CODE: strcpy(errcode, #CODE);break;
-static void hori_urb_error(const struct device *dev, int error)
+static void hori_urb_error(struct hori *hori, int error)
 {
 	char errcode[16];
+
+	atomic_long_inc(&hori->stats[HORI_STAT_SUBMIT_ERRORS]);
+
 	switch(error) {
 		ERRCASE(ENOMEM)
 		ERRCASE(EBUSY)
@@ -107,282 +368,2034 @@ static void hori_urb_error(const struct device *dev, int error)
 		default:
 			strcpy(errcode, "Unknown");
 	}
-	dev_err(dev,
-		"%s - usb_submit_urb failed with result: %d (%s)",
-		__func__, error, errcode);
+	dev_err(hori->dev,
+		"%s - usb_submit_urb failed with result: %d (%s)",
+		__func__, error, errcode);
+}
+
+static void hori_count_status(struct hori *hori, int status)
+{
+	enum hori_stat stat;
+
+	switch (status) {
+	case -ETIME:
+		stat = HORI_STAT_ERR_ETIME;
+		break;
+	case -EPIPE:
+		stat = HORI_STAT_ERR_EPIPE;
+		break;
+	case -EPROTO:
+		stat = HORI_STAT_ERR_EPROTO;
+		break;
+	case -EILSEQ:
+		stat = HORI_STAT_ERR_EILSEQ;
+		break;
+	case -EOVERFLOW:
+		stat = HORI_STAT_ERR_EOVERFLOW;
+		break;
+	case -ECONNRESET:
+	case -ENOENT:
+	case -ESHUTDOWN:
+		stat = HORI_STAT_ERR_SHUTDOWN;
+		break;
+	default:
+		stat = HORI_STAT_ERR_OTHER;
+		break;
+	}
+
+	atomic_long_inc(&hori->stats[stat]);
+}
+
+/*
+ * What a completion does next, decided by its status alone so the poll
+ * state machine doesn't need a URB to be exercised.
+ */
+enum hori_next {
+	HORI_NEXT_DATA,		/* good transfer: use it, resubmit */
+	HORI_NEXT_RETRY,	/* bad transfer: resubmit after a backoff */
+	HORI_NEXT_HALT,		/* endpoint halted: clear it, then retry */
+	HORI_NEXT_STOP,		/* unlinked or device gone: don't resubmit */
+};
+
+static enum hori_next hori_vr_next(int status)
+{
+	switch (status) {
+	case 0:
+		return HORI_NEXT_DATA;
+	case -ECONNRESET:
+	case -ENOENT:
+	case -ESHUTDOWN:
+	case -ENODEV:
+		return HORI_NEXT_STOP;
+	default:
+		/*
+		 * Timeouts, transmission errors and stalls. A stall on ep0
+		 * is a protocol stall that the next setup packet clears,
+		 * so it needs no CLEAR_FEATURE.
+		 */
+		return HORI_NEXT_RETRY;
+	}
+}
+
+static enum hori_next hori_irq_next(int status)
+{
+	switch (status) {
+	case 0:
+		return HORI_NEXT_DATA;
+	case -ECONNRESET:
+	case -ENOENT:
+	case -ESHUTDOWN:
+	case -ENODEV:
+		return HORI_NEXT_STOP;
+	case -EPIPE:
+		return HORI_NEXT_HALT;
+	default:
+		return HORI_NEXT_RETRY;
+	}
+}
+
+static unsigned long hori_backoff(unsigned int retries)
+{
+	return msecs_to_jiffies(min(HORI_RETRY_MIN_MS << min(retries, 10U),
+				    HORI_RETRY_MAX_MS));
+}
+
+static struct dentry *hori_debugfs_root;
+static DEFINE_IDA(hori_ida);
+
+/*
+ * Everything that may sleep runs here: halt clearing, resubmits after a
+ * backoff and the watchdog. Completions and the poll timer only ever
+ * resubmit with GFP_ATOMIC and never wait, so they are safe at any
+ * poll rate, on PREEMPT_RT as well.
+ */
+static struct workqueue_struct *hori_wq;
+
+static void hori_ring_write(struct hori *hori, u8 type, const void *data,
+			    unsigned int len, ktime_t stamp)
+{
+	struct hori_ring *ring = hori->ring;
+	struct hori_ring_slot *slot;
+	u32 seq;
+
+	if (!ring)
+		return;
+
+	seq = atomic_inc_return(&ring->head) - 1;
+	slot = &ring->slots[seq & ring->mask];
+
+	WRITE_ONCE(slot->commit, seq - 1);
+	smp_wmb();
+
+	len = min_t(unsigned int, len, sizeof(slot->rec.data));
+	slot->rec.time_ns = ktime_to_ns(stamp);
+	slot->rec.seq = seq;
+	slot->rec.type = type;
+	slot->rec.len = len;
+	memcpy(slot->rec.data, data, len);
+	memset(slot->rec.data + len, 0, sizeof(slot->rec.data) - len);
+
+	smp_store_release(&slot->commit, seq);
+
+	if (wq_has_sleeper(&ring->wait))
+		wake_up_interruptible(&ring->wait);
+}
+
+static void hori_hist_add(struct hori_hist *hist, enum hori_hist_type type,
+			  s64 ns)
+{
+	unsigned int bucket = ns > 0 ? fls64(ns) : 0;
+
+	atomic64_inc(&hist->bucket[type][min(bucket, HORI_HIST_BUCKETS - 1)]);
+}
+
+/* Completion of a transfer submitted at @submitted, received at @now */
+static void hori_hist_complete(struct hori_hist *hist, ktime_t submitted,
+			       ktime_t now)
+{
+	hori_hist_add(hist, HORI_HIST_RTT, ktime_to_ns(ktime_sub(now, submitted)));
+	if (hist->last)
+		hori_hist_add(hist, HORI_HIST_GAP,
+			      ktime_to_ns(ktime_sub(now, hist->last)));
+	hist->last = now;
+}
+
+/* A good transfer at @now; closes the recovery from an injected fault */
+static void hori_hist_recovered(struct hori_hist *hist, ktime_t now)
+{
+	if (!hist->fault)
+		return;
+
+	hori_hist_add(hist, HORI_HIST_RECOVER,
+		      ktime_to_ns(ktime_sub(now, hist->fault)));
+	hist->fault = 0;
+}
+
+#ifdef CONFIG_FAULT_INJECTION_DEBUG_FS
+/*
+ * Turns a completion into one of the enabled fault kinds before the
+ * handler looks at it, so everything downstream sees the fault exactly
+ * as it would see one from the bus.
+ */
+static void hori_fault(struct hori *hori, struct urb *urb,
+		       struct hori_hist *hist, ktime_t now)
+{
+	unsigned long kinds = READ_ONCE(hori->fault_kinds) &
+			      GENMASK(HORI_FAULT_KINDS - 1, 0);
+	unsigned int kind, n;
+
+	if (!kinds || urb->status || !should_fail(&hori->fault, 1))
+		return;
+
+	n = get_random_u32_below(hweight_long(kinds));
+	for_each_set_bit(kind, &kinds, HORI_FAULT_KINDS)
+		if (!n--)
+			break;
+
+	switch (kind) {
+	case HORI_FAULT_EPROTO:
+		urb->status = -EPROTO;
+		break;
+	case HORI_FAULT_ETIME:
+		urb->status = -ETIME;
+		break;
+	case HORI_FAULT_EPIPE:
+		urb->status = -EPIPE;
+		break;
+	case HORI_FAULT_SHORT:
+		urb->actual_length /= 2;
+		break;
+	}
+
+	if (!hist->fault)
+		hist->fault = now;
+	atomic_long_inc(&hori->stats[HORI_STAT_FAULTS_INJECTED]);
+}
+
+static void hori_fault_init(struct hori *hori, struct dentry *dir)
+{
+	hori->fault = (struct fault_attr)FAULT_ATTR_INITIALIZER;
+	/* a stack dump per fault would swamp the recovery being timed */
+	hori->fault.verbose = 0;
+	hori->fault_kinds = GENMASK(HORI_FAULT_KINDS - 1, 0);
+
+	fault_create_debugfs_attr("fault", dir, &hori->fault);
+	debugfs_create_u32("fault_kinds", 0600, dir, &hori->fault_kinds);
+}
+#else
+static inline void hori_fault(struct hori *hori, struct urb *urb,
+			      struct hori_hist *hist, ktime_t now)
+{
+}
+
+static inline void hori_fault_init(struct hori *hori, struct dentry *dir)
+{
+}
+#endif
+
+/* Returns the number of events reported */
+static unsigned int hori_report_irq(struct hori *hori, const u8 *data)
+{
+	hori_debug(hori, "irq: %*ph\n", HORI_IRQ_REPORT_LEN, data);
+
+	return hori_decode_irq(hori->input, data);
+}
+
+static unsigned int hori_report_vr(struct hori *hori, unsigned int vr,
+				   u16 word)
+{
+	u16 changed = hori_vr_changed(&hori->dec, vr, word);
+
+	if (!changed)
+		return 0;
+
+	hori_debug(hori, "vr%u: %04x changed %04x\n", vr, word, changed);
+
+	return hori_decode_vr(&hori->dec, hori->input, vr, word);
+}
+
+static_assert(HORI_STATE_AXES == HORI_IRQ_AXES);
+static_assert(HORI_STATE_HATS == HORI_VR_AXES);
+
+static void hori_shm_stamp(struct hori *hori, unsigned int field,
+			   bool changed, unsigned int src)
+{
+	if (changed)
+		hori->shm->changed_ns[field] =
+			ktime_to_ns(hori->frame.stamp[src]);
+}
+
+/*
+ * Publishes hori->state to the mapped page, stamping each part that
+ * changed with the completion it came from. Same protocol as a seqcount,
+ * spelled out because userspace reads the counter directly.
+ */
+static void hori_shm_update(struct hori *hori, const struct hori_state *old)
+{
+	const struct hori_state *st = &hori->state;
+	struct hori_shm *shm = hori->shm;
+	u32 seq = shm->seq;
+	unsigned int vr;
+
+	if (!memcmp(old, st, sizeof(*st)))
+		return;
+
+	WRITE_ONCE(shm->seq, seq + 1);
+	smp_wmb();
+
+	shm->state = *st;
+	hori_shm_stamp(hori, HORI_SHM_AXES,
+		       memcmp(old->axes, st->axes, sizeof(st->axes)),
+		       HORI_FRAME_IRQ);
+	hori_shm_stamp(hori, HORI_SHM_PRESSURE,
+		       memcmp(old->pressure, st->pressure, sizeof(st->pressure)),
+		       HORI_FRAME_IRQ);
+	for (vr = 0; vr < HORI_VR_COUNT; vr++)
+		hori_shm_stamp(hori, HORI_SHM_BUTTONS_VR0 + vr,
+			       old->buttons[vr] != st->buttons[vr], vr);
+	/* the hats and the mode switch are all in VR1 */
+	hori_shm_stamp(hori, HORI_SHM_HATS,
+		       memcmp(old->hats, st->hats, sizeof(st->hats)),
+		       HORI_FRAME_VR1);
+	hori_shm_stamp(hori, HORI_SHM_MODE, old->mode != st->mode,
+		       HORI_FRAME_VR1);
+
+	smp_wmb();
+	WRITE_ONCE(shm->seq, seq + 2);
+}
+
+/*
+ * Brings hori->state up to date with the frame being flushed. All writers
+ * hold frame_lock, so readers only ever spin on the sequence count and
+ * never contend with the completions.
+ */
+static void hori_state_update(struct hori *hori)
+{
+	struct hori_frame *frame = &hori->frame;
+	struct hori_state old = hori->state;
+	unsigned int vr;
+
+	write_seqcount_begin(&hori->state_seq);
+	if (test_bit(HORI_FRAME_IRQ, &frame->dirty))
+		hori_state_irq(&hori->state, frame->report);
+	for (vr = 0; vr < HORI_VR_COUNT; vr++)
+		if (test_bit(vr, &frame->dirty))
+			hori_state_vr(&hori->state, &hori->dec, vr,
+				      le16_to_cpu(frame->vr[vr]));
+	write_seqcount_end(&hori->state_seq);
+
+	hori_shm_update(hori, &old);
+}
+
+/* A consistent copy of hori->state, from any context */
+static void hori_state_read(struct hori *hori, struct hori_state *st)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqcount_begin(&hori->state_seq);
+		*st = hori->state;
+	} while (read_seqcount_retry(&hori->state_seq, seq));
+}
+
+/* Queues the frame being flushed to every /dev/hori-raw reader */
+static void hori_stream_frame(struct hori *hori)
+{
+	struct hori_frame *frame = &hori->frame;
+	struct hori_stream *stream = hori->stream;
+	struct hori_stream_reader *reader;
+	struct hori_frame_record rec = { 0 };
+	unsigned int src, vr;
+	ktime_t newest = 0;
+
+	if (!stream || !frame->dirty)
+		return;
+
+	for_each_set_bit(src, &frame->dirty, HORI_FRAME_SOURCES)
+		newest = max(newest, frame->stamp[src]);
+
+	rec.time_ns = ktime_to_ns(newest);
+	rec.seq = stream->seq++;
+	for (vr = 0; vr < HORI_VR_COUNT; vr++)
+		rec.vr[vr] = le16_to_cpu(frame->vr[vr]);
+	memcpy(rec.report, frame->report, sizeof(rec.report));
+	rec.dirty = frame->dirty;
+
+	spin_lock(&stream->lock);
+	list_for_each_entry(reader, &stream->readers, node)
+		kfifo_put(&reader->fifo, rec);	/* full: the seq gap tells */
+	spin_unlock(&stream->lock);
+
+	if (wq_has_sleeper(&stream->wait))
+		wake_up_interruptible_poll(&stream->wait, EPOLLIN | EPOLLRDNORM);
+}
+
+/* Called with frame_lock held */
+static void hori_frame_flush(struct hori *hori)
+{
+	struct hori_frame *frame = &hori->frame;
+	unsigned int vr, events = 0;
+
+	if (test_bit(HORI_FRAME_IRQ, &frame->dirty))
+		events += hori_report_irq(hori, frame->report);
+	for (vr = 0; vr < HORI_VR_COUNT; vr++) {
+		if (test_bit(vr, &frame->dirty))
+			events += hori_report_vr(hori, vr,
+						 le16_to_cpu(frame->vr[vr]));
+	}
+
+	hori_state_update(hori);
+	hori_stream_frame(hori);
+
+	if (events) {
+		ktime_t now;
+		unsigned int src;
+
+		input_sync(hori->input);
+		trace_hori_sync(hori->dev, frame->dirty, events);
+		atomic_long_add(events, &hori->stats[HORI_STAT_EVENTS]);
+		atomic_long_inc(&hori->stats[HORI_STAT_SYNCS]);
+
+		now = ktime_get();
+		for_each_set_bit(src, &frame->dirty, HORI_FRAME_SOURCES)
+			hori_hist_add(&hori->hist[src], HORI_HIST_SYNC,
+				      ktime_to_ns(ktime_sub(now, frame->stamp[src])));
+	}
+	frame->dirty = 0;
+}
+
+/*
+ * Fold one source's data into the current frame. In frame mode the frame
+ * is reported once no other VR request it is waiting for is in flight, or
+ * early if a source delivers twice, so no intermediate state gets lost.
+ * Otherwise every source is reported on its own as it arrives.
+ */
+static void hori_frame_commit(struct hori *hori, unsigned int src,
+			      const void *data, ktime_t stamp)
+{
+	struct hori_frame *frame = &hori->frame;
+	unsigned long flags;
+
+	spin_lock_irqsave(&hori->frame_lock, flags);
+
+	if (test_bit(src, &frame->dirty))
+		hori_frame_flush(hori);
+
+	if (src == HORI_FRAME_IRQ)
+		memcpy(frame->report, data, sizeof(frame->report));
+	else
+		memcpy(&frame->vr[src], data, sizeof(frame->vr[src]));
+	frame->stamp[src] = stamp;
+	__set_bit(src, &frame->dirty);
+
+	/*
+	 * A frame is complete once both VR words are in it, or when no other
+	 * request is in flight to add to it. Back to back, one always is. A
+	 * request backing off after an error won't add to it any time soon.
+	 */
+	if (!READ_ONCE(frame_mode) ||
+	    (frame->dirty & HORI_VR_MASK) == HORI_VR_MASK ||
+	    !(READ_ONCE(hori->flags) & ~READ_ONCE(hori->vr_backoff) &
+	      HORI_VR_MASK & ~BIT(src)))
+		hori_frame_flush(hori);
+
+	spin_unlock_irqrestore(&hori->frame_lock, flags);
+}
+
+/*
+ * The request stays marked in flight until the retry, so the poll timer
+ * leaves it alone meanwhile. Frames stop waiting for it, and whatever the
+ * current one holds, say the stick coming back to centre, goes out now.
+ */
+static void hori_vr_retry(struct hori_ctl *ctl)
+{
+	struct hori *hori = ctl->hori;
+	unsigned long flags;
+
+	if (!READ_ONCE(hori->polling)) {
+		clear_bit(ctl->vr, &hori->flags);
+		return;
+	}
+
+	set_bit(ctl->vr, &hori->vr_backoff);
+	spin_lock_irqsave(&hori->frame_lock, flags);
+	if (hori->frame.dirty)
+		hori_frame_flush(hori);
+	spin_unlock_irqrestore(&hori->frame_lock, flags);
+
+	if (queue_delayed_work(hori_wq, &ctl->retry,
+			       hori_backoff(ctl->retries))) {
+		ctl->retries++;
+		atomic_long_inc(&hori->stats[HORI_STAT_RETRIES]);
+	}
+}
+
+/*
+ * @gfp is GFP_ATOMIC from the poll timer and completions. A submit that
+ * failed for lack of atomic memory is retried from hori_wq, where it
+ * may sleep for it.
+ */
+static void hori_poll_vr(struct hori_ctl *ctl, gfp_t gfp)
+{
+	struct hori *hori = ctl->hori;
+	int error;
+
+	ctl->submitted = ktime_get();
+	error = usb_submit_urb(ctl->urb, gfp);
+	trace_hori_vr_submit(hori->dev, ctl->vr, error);
+	if (!error)
+		return;
+
+	if (error != -EPERM)
+		hori_urb_error(hori, error);
+	if (error == -ENOMEM)
+		hori_vr_retry(ctl);
+	else
+		clear_bit(ctl->vr, &hori->flags);
+}
+
+/* Request done; when paced, the poll timer issues the next one */
+static void hori_poll_vr_next(struct hori_ctl *ctl)
+{
+	if (READ_ONCE(ctl->hori->poll_rate))
+		clear_bit(ctl->vr, &ctl->hori->flags);
+	else
+		hori_poll_vr(ctl, GFP_ATOMIC);
+}
+
+static void hori_vr_retry_work(struct work_struct *work)
+{
+	struct hori_ctl *ctl = container_of(to_delayed_work(work),
+					    struct hori_ctl, retry);
+
+	clear_bit(ctl->vr, &ctl->hori->vr_backoff);
+	if (READ_ONCE(ctl->hori->polling))
+		hori_poll_vr(ctl, GFP_KERNEL);
+	else
+		clear_bit(ctl->vr, &ctl->hori->flags);
+}
+
+static void hori_poll_vr_complete(struct urb *urb)
+{
+	struct hori_ctl *ctl = urb->context;
+	struct hori *hori = ctl->hori;
+	ktime_t now = ktime_get();
+
+	hori_fault(hori, urb, &hori->hist[ctl->vr], now);
+	trace_hori_vr_complete(hori->dev, ctl->vr, urb);
+	WRITE_ONCE(ctl->completed, now);
+
+	hori_debug(hori, "%s: vr%u status %d len %u\n", __func__, ctl->vr,
+		   urb->status, urb->actual_length);
+	if (urb->status)
+		hori_count_status(hori, urb->status);
+
+	switch (hori_vr_next(urb->status)) {
+	case HORI_NEXT_DATA:
+		hori_ring_write(hori, ctl->vr, urb->transfer_buffer,
+				urb->actual_length, now);
+		if (urb->actual_length < sizeof(hori->vr[ctl->vr])) {
+			dev_dbg(hori->dev, "%s - short vr%u read: %u\n",
+				__func__, ctl->vr, urb->actual_length);
+			break;
+		}
+		hori_hist_complete(&hori->hist[ctl->vr], ctl->submitted, now);
+		hori_hist_recovered(&hori->hist[ctl->vr], now);
+		atomic_long_inc(&hori->stats[ctl->vr == HORI_POLL_VR0 ?
+					     HORI_STAT_VR0_POLLS :
+					     HORI_STAT_VR1_POLLS]);
+		if (ctl->retries) {
+			ctl->retries = 0;
+			atomic_long_inc(&hori->stats[HORI_STAT_RECOVERIES]);
+		}
+		hori_frame_commit(hori, ctl->vr, &hori->vr[ctl->vr], now);
+		break;
+	case HORI_NEXT_STOP:
+		dev_warn(hori->dev, "%s - urb shutting down with status: %d\n",
+			__func__, urb->status);
+		clear_bit(ctl->vr, &hori->flags);
+		return;
+	case HORI_NEXT_RETRY:
+	case HORI_NEXT_HALT:
+		if (urb->status == -ETIME)
+			dev_warn_ratelimited(hori->dev,
+				"%s - urb timed out - was the device unplugged?\n",
+				__func__);
+		else if (urb->status != -EPIPE)
+			dev_err_ratelimited(hori->dev,
+				"%s - nonzero urb status received: %d\n",
+				__func__, urb->status);
+		hori_vr_retry(ctl);
+		return;
+	}
+
+	hori_poll_vr_next(ctl);
+}
+
+static enum hrtimer_restart hori_poll_timer(struct hrtimer *timer)
+{
+	struct hori *hori = container_of(timer, struct hori, poll_timer);
+	unsigned int rate = READ_ONCE(hori->poll_rate);
+	int i;
+
+	if (!rate)
+		return HRTIMER_NORESTART;
+
+	/*
+	 * Both requests go out together and the HCD queues them back to back
+	 * on EP0. A pipeline whose previous request is still in flight skips
+	 * this tick.
+	 */
+	for (i = 0; i < HORI_VR_COUNT; i++)
+		if (!test_and_set_bit(i, &hori->flags))
+			hori_poll_vr(&hori->ctl[i], GFP_ATOMIC);
+
+	hrtimer_forward_now(timer, ns_to_ktime(NSEC_PER_SEC / rate));
+	return HRTIMER_RESTART;
+}
+
+static void hori_start_poll(struct hori *hori)
+{
+	int i;
+
+	for (i = 0; i < HORI_VR_COUNT; i++)
+		WRITE_ONCE(hori->ctl[i].completed, ktime_get());
+	WRITE_ONCE(hori->polling, true);
+
+	if (READ_ONCE(hori->poll_rate)) {
+		hrtimer_start(&hori->poll_timer, 0, HORI_POLL_TIMER_MODE);
+		return;
+	}
+
+	for (i = 0; i < HORI_VR_COUNT; i++)
+		if (!test_and_set_bit(i, &hori->flags))
+			hori_poll_vr(&hori->ctl[i], GFP_ATOMIC);
+}
+
+static void hori_stop_poll(struct hori *hori)
+{
+	int i;
+
+	WRITE_ONCE(hori->polling, false);
+	hrtimer_cancel(&hori->poll_timer);
+
+	/*
+	 * A running retry may submit once more before it is cancelled, and
+	 * a completion racing with the kill may queue one after it; the
+	 * second cancel catches that before it gets to run.
+	 */
+	for (i = 0; i < HORI_VR_COUNT; i++) {
+		cancel_delayed_work_sync(&hori->ctl[i].retry);
+		usb_kill_urb(hori->ctl[i].urb);
+		cancel_delayed_work_sync(&hori->ctl[i].retry);
+		clear_bit(i, &hori->flags);
+		clear_bit(i, &hori->vr_backoff);
+		hori->ctl[i].retries = 0;
+	}
+}
+
+static unsigned long hori_watchdog_timeout(struct hori *hori)
+{
+	unsigned int rate = READ_ONCE(hori->poll_rate);
+	unsigned int ms = 0;
+
+	if (rate)
+		ms = DIV_ROUND_UP(READ_ONCE(watchdog) * MSEC_PER_SEC, rate);
+
+	return msecs_to_jiffies(max(ms, HORI_WATCHDOG_MIN_MS));
+}
+
+/*
+ * Catches a poll chain that went quiet without an error to retry on, e.g.
+ * a completion that never came or a lost timer. A pending retry is a
+ * chain that is still alive, just backing off.
+ */
+static void hori_watchdog_work(struct work_struct *work)
+{
+	struct hori *hori = container_of(to_delayed_work(work), struct hori,
+					 watchdog);
+	unsigned long timeout = hori_watchdog_timeout(hori);
+	ktime_t now = ktime_get();
+	s64 stalled = 0;
+	int i;
+
+	guard(mutex)(&hori->pm_mutex);
+	if (!hori->is_open)
+		return;
+
+	for (i = 0; i < HORI_VR_COUNT; i++) {
+		if (delayed_work_pending(&hori->ctl[i].retry))
+			continue;
+		stalled = max(stalled, ktime_ms_delta(now,
+					READ_ONCE(hori->ctl[i].completed)));
+	}
+
+	if (READ_ONCE(watchdog) && hori->polling &&
+	    stalled > jiffies_to_msecs(timeout)) {
+		dev_warn(hori->dev,
+			 "button polling stalled for %lld ms, restarting\n",
+			 stalled);
+		hori_stop_poll(hori);
+		hori_start_poll(hori);
+		atomic_long_inc(&hori->stats[HORI_STAT_WATCHDOG_RESTARTS]);
+	}
+
+	queue_delayed_work(hori_wq, &hori->watchdog, timeout);
+}
+
+/* @gfp is GFP_KERNEL only from process context, GFP_ATOMIC elsewhere */
+static int hori_irq_submit(struct hori_irq *irq, gfp_t gfp)
+{
+	struct hori *hori = irq->hori;
+	int error;
+
+	irq->seq = atomic_inc_return(&hori->irq_seq) - 1;
+	irq->submitted = ktime_get();
+	usb_anchor_urb(irq->urb, &hori->irq_anchor);
+	error = usb_submit_urb(irq->urb, gfp);
+	if (error)
+		usb_unanchor_urb(irq->urb);
+
+	return error;
+}
+
+/* Same ordering as hori_stop_poll(), for the same reasons */
+static void hori_stop_irq(struct hori *hori)
+{
+	WRITE_ONCE(hori->irq_running, false);
+	cancel_delayed_work_sync(&hori->irq_retry);
+	usb_kill_anchored_urbs(&hori->irq_anchor);
+	cancel_delayed_work_sync(&hori->irq_retry);
+}
+
+static int hori_start_irq(struct hori *hori)
+{
+	unsigned int i;
+	int error;
+
+	hori->irq_next_seq = atomic_read(&hori->irq_seq);
+	hori->irq_window = ktime_get();
+	hori->irq_window_reports = 0;
+	hori->irq_parked = 0;
+	hori->irq_retries = 0;
+	WRITE_ONCE(hori->irq_running, true);
+	for (i = 0; i < hori->irq_count; i++) {
+		error = hori_irq_submit(&hori->irq[i], GFP_KERNEL);
+		if (error) {
+			hori_stop_irq(hori);
+			return error;
+		}
+	}
+
+	return 0;
+}
+
+/* Achieved report rate, measured over roughly one second windows */
+static void hori_irq_account(struct hori *hori, ktime_t now)
+{
+	s64 elapsed = ktime_to_ns(ktime_sub(now, hori->irq_window));
+
+	hori->irq_window_reports++;
+	if (elapsed < NSEC_PER_SEC)
+		return;
+
+	WRITE_ONCE(hori->irq_rate,
+		   div64_u64((u64)hori->irq_window_reports * NSEC_PER_SEC, elapsed));
+	hori->irq_window_reports = 0;
+	hori->irq_window = now;
+}
+
+/*
+ * The queued URBs should complete in submission order. A report older
+ * than one already delivered is dropped so the axes never step backwards.
+ */
+static bool hori_irq_in_order(struct hori *hori, u32 seq)
+{
+	if (seq != hori->irq_next_seq) {
+		hori->irq_reordered++;
+		if ((s32)(seq - hori->irq_next_seq) < 0)
+			return false;
+	}
+	hori->irq_next_seq = seq + 1;
+
+	return true;
+}
+
+/* An interrupt report received in order; replay feeds them in here too */
+static void hori_irq_report(struct hori *hori, const u8 *data,
+			    unsigned int len, ktime_t now)
+{
+	u64 report;
+
+	if (len != HORI_IRQ_REPORT_LEN) {
+		dev_warn_ratelimited(hori->dev,
+				     "%s - urb->actual_length == %u\n",
+				     __func__, len);
+		return;
+	}
+
+	/* At rest the stick repeats itself, nothing to report then */
+	report = get_unaligned_le64(data);
+	if (hori->irq_prev_valid && report == hori->irq_prev) {
+		hori->irq_suppressed++;
+		return;
+	}
+	hori->irq_prev = report;
+	hori->irq_prev_valid = true;
+
+	hori_frame_commit(hori, HORI_FRAME_IRQ, data, now);
+}
+
+static void hori_irq_backoff(struct hori *hori)
+{
+	if (queue_delayed_work(hori_wq, &hori->irq_retry,
+			       hori_backoff(hori->irq_retries))) {
+		hori->irq_retries++;
+		atomic_long_inc(&hori->stats[HORI_STAT_RETRIES]);
+	}
+}
+
+/*
+ * Parks a failed URB for irq_retry, which clears a halt first if there
+ * was one. URBs still in flight carry on meanwhile.
+ */
+static void hori_irq_retry(struct hori_irq *irq, bool halted)
+{
+	struct hori *hori = irq->hori;
+
+	if (!READ_ONCE(hori->irq_running))
+		return;
+
+	set_bit(irq - hori->irq, &hori->irq_parked);
+	if (halted)
+		set_bit(HORI_IRQ_HALTED, &hori->irq_parked);
+	hori_irq_backoff(hori);
+}
+
+static void hori_irq_retry_work(struct work_struct *work)
+{
+	struct hori *hori = container_of(to_delayed_work(work), struct hori,
+					 irq_retry);
+	struct usb_device *udev = interface_to_usbdev(hori->intf);
+	unsigned int i;
+	int error;
+
+	if (!READ_ONCE(hori->irq_running))
+		return;
+
+	/*
+	 * Nothing may be queued on the endpoint while its halt is cleared,
+	 * so the URBs still in flight are unlinked and parked with the ones
+	 * that halted. Once it is cleared the whole queue goes back out, as
+	 * in hori_start_irq().
+	 */
+	if (test_bit(HORI_IRQ_HALTED, &hori->irq_parked)) {
+		WRITE_ONCE(hori->irq_clearing, true);
+		usb_kill_anchored_urbs(&hori->irq_anchor);
+		WRITE_ONCE(hori->irq_clearing, false);
+		for (i = 0; i < hori->irq_count; i++)
+			set_bit(i, &hori->irq_parked);
+		hori->irq_next_seq = atomic_read(&hori->irq_seq);
+
+		error = usb_clear_halt(udev, usb_rcvintpipe(udev,
+					hori->epirq->bEndpointAddress));
+		if (error) {
+			dev_err(hori->dev, "%s - usb_clear_halt failed: %d\n",
+				__func__, error);
+			hori_irq_backoff(hori);
+			return;
+		}
+		clear_bit(HORI_IRQ_HALTED, &hori->irq_parked);
+		atomic_long_inc(&hori->stats[HORI_STAT_HALTS_CLEARED]);
+	}
+
+	for (i = 0; i < hori->irq_count; i++) {
+		if (!test_and_clear_bit(i, &hori->irq_parked))
+			continue;
+
+		error = hori_irq_submit(&hori->irq[i], GFP_KERNEL);
+		if (error && error != -EPERM)
+			hori_urb_error(hori, error);
+		if (error == -ENOMEM)
+			hori_irq_retry(&hori->irq[i], false);
+	}
+}
+
+static void hori_usb_irq(struct urb *urb)
+{
+	struct hori_irq *irq = urb->context;
+	struct hori *hori = irq->hori;
+	u8 *data = urb->transfer_buffer;
+	ktime_t now = ktime_get();
+	int error;
+
+	hori_fault(hori, urb, &hori->hist[HORI_FRAME_IRQ], now);
+	trace_hori_irq(hori->dev, irq->seq, urb);
+
+	/* Unlinked to clear a halt; hori_irq_retry_work() resubmits it */
+	if (urb->status == -ENOENT && READ_ONCE(hori->irq_clearing))
+		return;
+	hori_debug(hori, "%s: seq %u status %d len %u\n", __func__, irq->seq,
+		   urb->status, urb->actual_length);
+
+	if (urb->status)
+		hori_count_status(hori, urb->status);
+
+	switch (hori_irq_next(urb->status)) {
+	case HORI_NEXT_DATA:
+		hori_ring_write(hori, HORI_RAW_IRQ, data, urb->actual_length, now);
+		hori_irq_account(hori, now);
+		hori_hist_complete(&hori->hist[HORI_FRAME_IRQ], irq->submitted, now);
+		if (urb->actual_length >= HORI_IRQ_REPORT_LEN)
+			hori_hist_recovered(&hori->hist[HORI_FRAME_IRQ], now);
+		atomic_long_inc(&hori->stats[HORI_STAT_IRQ_REPORTS]);
+		if (hori->irq_retries) {
+			hori->irq_retries = 0;
+			atomic_long_inc(&hori->stats[HORI_STAT_RECOVERIES]);
+		}
+		if (hori_irq_in_order(hori, irq->seq))
+			hori_irq_report(hori, data, urb->actual_length, now);
+		break;
+	case HORI_NEXT_STOP:
+		dev_dbg(hori->dev, "%s - urb shutting down with status: %d\n",
+			__func__, urb->status);
+		return;
+	case HORI_NEXT_RETRY:
+	case HORI_NEXT_HALT:
+		dev_dbg(hori->dev, "%s - nonzero urb status received: %d\n",
+			__func__, urb->status);
+		hori->irq_next_seq = irq->seq + 1;
+		hori_irq_retry(irq, urb->status == -EPIPE);
+		return;
+	}
+
+	/* Resubmit to fetch new fresh URBs; hori_wq retries on -ENOMEM */
+	error = hori_irq_submit(irq, GFP_ATOMIC);
+	if (error && error != -EPERM)
+		hori_urb_error(hori, error);
+	if (error == -ENOMEM)
+		hori_irq_retry(irq, false);
+}
+
+/*
+ * The interval override only reaches the HCDs that schedule by
+ * urb->interval (EHCI, OHCI, UHCI). xHCI polls at the bInterval it put
+ * in the endpoint context when the interface was configured.
+ */
+static void hori_fill_irq(struct hori *hori, struct hori_irq *irq)
+{
+	struct usb_device *udev = interface_to_usbdev(hori->intf);
+	unsigned int interval = hori->irq_interval ?: hori->epirq->bInterval;
+
+	usb_fill_int_urb(irq->urb, udev,
+			 usb_rcvintpipe(udev, hori->epirq->bEndpointAddress),
+			 irq->buf, hori->irq_len, hori_usb_irq, irq, interval);
+	irq->urb->transfer_dma = irq->dma;
+	irq->urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+}
+
+static int hori_open(struct input_dev *input)
+{
+	struct hori *hori = input_get_drvdata(input);
+	int error;
+
+	guard(mutex)(&hori->pm_mutex);
+	error = hori_start_irq(hori);
+	if (error) {
+		dev_err(hori->dev,
+			"%s - usb_submit_urb failed, error: %d\n",
+			__func__, error);
+		return -EIO;
+	}
+
+	hori->is_open = true;
+	hori_start_poll(hori);
+	queue_delayed_work(hori_wq, &hori->watchdog,
+			   hori_watchdog_timeout(hori));
+
+	return 0;
+}
+
+static void hori_close(struct input_dev *input)
+{
+	struct hori *hori = input_get_drvdata(input);
+	unsigned int i;
+
+	dev_warn(hori->dev,
+		"%s - usb_kill_urb\n",
+		__func__);
+	/* before pm_mutex, which the watchdog takes */
+	cancel_delayed_work_sync(&hori->watchdog);
+	guard(mutex)(&hori->pm_mutex);
+	hori_stop_irq(hori);
+	hori_stop_poll(hori);
+	hori->is_open = false;
+
+	/*
+	 * Don't replay a half-assembled frame on the next open, and report
+	 * every button again once it is reopened.
+	 */
+	scoped_guard(spinlock_irqsave, &hori->frame_lock) {
+		hori->frame.dirty = 0;
+		hori->dec.vr_valid = 0;
+	}
+	hori->irq_prev_valid = false;
+	for (i = 0; i < HORI_FRAME_SOURCES; i++) {
+		hori->hist[i].last = 0;
+		hori->hist[i].fault = 0;
+	}
+}
+
+static void hori_free_urb(void *_hori)
+{
+	struct hori *hori = _hori;
+	struct usb_device *udev = interface_to_usbdev(hori->intf);
+	int i;
+
+	dev_warn(hori->dev,
+		"%s - usb_free_urb\n",
+		__func__);
+
+	for (i = 0; i < HORI_IRQ_URBS_MAX; i++) {
+		usb_free_urb(hori->irq[i].urb);
+		usb_free_coherent(udev, hori->irq_len, hori->irq[i].buf,
+				  hori->irq[i].dma);
+	}
+	usb_free_urb(hori->ctl[HORI_POLL_VR0].urb);
+	usb_free_urb(hori->ctl[HORI_POLL_VR1].urb);
+	usb_free_coherent(udev, HORI_VR_COUNT * sizeof(*hori->vr), hori->vr,
+			  hori->vr_dma);
+}
+
+static ssize_t poll_rate_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct hori *hori = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(hori->poll_rate));
+}
+
+static ssize_t poll_rate_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct hori *hori = dev_get_drvdata(dev);
+	unsigned int rate;
+	int error;
+
+	error = kstrtouint(buf, 0, &rate);
+	if (error)
+		return error;
+	if (rate > HORI_POLL_RATE_MAX)
+		return -EINVAL;
+
+	guard(mutex)(&hori->pm_mutex);
+	hrtimer_cancel(&hori->poll_timer);
+	WRITE_ONCE(hori->poll_rate, rate);
+	if (hori->is_open)
+		hori_start_poll(hori);
+
+	return count;
+}
+static DEVICE_ATTR_RW(poll_rate);
+
+static ssize_t irq_interval_show(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct hori *hori = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(hori->irq_interval));
+}
+
+/* Re-arms the interrupt queue with the new interval if it is running */
+static ssize_t irq_interval_store(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	struct hori *hori = dev_get_drvdata(dev);
+	unsigned int interval, i;
+	int error;
+
+	error = kstrtouint(buf, 0, &interval);
+	if (error)
+		return error;
+	if (interval > HORI_IRQ_INTERVAL_MAX)
+		return -EINVAL;
+
+	guard(mutex)(&hori->pm_mutex);
+	if (hori->is_open)
+		hori_stop_irq(hori);
+
+	WRITE_ONCE(hori->irq_interval, interval);
+	for (i = 0; i < hori->irq_count; i++)
+		hori_fill_irq(hori, &hori->irq[i]);
+
+	if (hori->is_open) {
+		error = hori_start_irq(hori);
+		if (error)
+			return error;
+	}
+
+	return count;
+}
+static DEVICE_ATTR_RW(irq_interval);
+
+static ssize_t irq_rate_show(struct device *dev,
+			     struct device_attribute *attr, char *buf)
+{
+	struct hori *hori = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%u\n", READ_ONCE(hori->irq_rate));
+}
+static DEVICE_ATTR_RO(irq_rate);
+
+static ssize_t irq_suppressed_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct hori *hori = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%lu\n", READ_ONCE(hori->irq_suppressed));
+}
+static DEVICE_ATTR_RO(irq_suppressed);
+
+static ssize_t irq_reordered_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct hori *hori = dev_get_drvdata(dev);
+
+	return sysfs_emit(buf, "%lu\n", READ_ONCE(hori->irq_reordered));
+}
+static DEVICE_ATTR_RO(irq_reordered);
+
+static struct attribute *hori_attrs[] = {
+	&dev_attr_poll_rate.attr,
+	&dev_attr_irq_interval.attr,
+	&dev_attr_irq_rate.attr,
+	&dev_attr_irq_suppressed.attr,
+	&dev_attr_irq_reordered.attr,
+	NULL
+};
+
+static const struct attribute_group hori_group = {
+	.attrs = hori_attrs,
+};
+
+struct hori_stat_attribute {
+	struct device_attribute	attr;
+	enum hori_stat		stat;
+};
+
+static ssize_t hori_stat_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct hori *hori = dev_get_drvdata(dev);
+	struct hori_stat_attribute *sa =
+		container_of(attr, struct hori_stat_attribute, attr);
+
+	return sysfs_emit(buf, "%ld\n", atomic_long_read(&hori->stats[sa->stat]));
+}
+
+#define HORI_STAT_ATTR(_name, _stat)					\
+	static struct hori_stat_attribute hori_stat_attr_##_name = {	\
+		.attr = __ATTR(_name, 0444, hori_stat_show, NULL),	\
+		.stat = _stat,						\
+	}
+
+HORI_STAT_ATTR(irq_reports, HORI_STAT_IRQ_REPORTS);
+HORI_STAT_ATTR(vr0_polls, HORI_STAT_VR0_POLLS);
+HORI_STAT_ATTR(vr1_polls, HORI_STAT_VR1_POLLS);
+HORI_STAT_ATTR(err_etime, HORI_STAT_ERR_ETIME);
+HORI_STAT_ATTR(err_epipe, HORI_STAT_ERR_EPIPE);
+HORI_STAT_ATTR(err_eproto, HORI_STAT_ERR_EPROTO);
+HORI_STAT_ATTR(err_eilseq, HORI_STAT_ERR_EILSEQ);
+HORI_STAT_ATTR(err_eoverflow, HORI_STAT_ERR_EOVERFLOW);
+HORI_STAT_ATTR(err_shutdown, HORI_STAT_ERR_SHUTDOWN);
+HORI_STAT_ATTR(err_other, HORI_STAT_ERR_OTHER);
+HORI_STAT_ATTR(submit_errors, HORI_STAT_SUBMIT_ERRORS);
+HORI_STAT_ATTR(retries, HORI_STAT_RETRIES);
+HORI_STAT_ATTR(halts_cleared, HORI_STAT_HALTS_CLEARED);
+HORI_STAT_ATTR(recoveries, HORI_STAT_RECOVERIES);
+HORI_STAT_ATTR(watchdog_restarts, HORI_STAT_WATCHDOG_RESTARTS);
+HORI_STAT_ATTR(faults_injected, HORI_STAT_FAULTS_INJECTED);
+HORI_STAT_ATTR(events, HORI_STAT_EVENTS);
+HORI_STAT_ATTR(syncs, HORI_STAT_SYNCS);
+
+static struct attribute *hori_stats_attrs[] = {
+	&hori_stat_attr_irq_reports.attr.attr,
+	&hori_stat_attr_vr0_polls.attr.attr,
+	&hori_stat_attr_vr1_polls.attr.attr,
+	&hori_stat_attr_err_etime.attr.attr,
+	&hori_stat_attr_err_epipe.attr.attr,
+	&hori_stat_attr_err_eproto.attr.attr,
+	&hori_stat_attr_err_eilseq.attr.attr,
+	&hori_stat_attr_err_eoverflow.attr.attr,
+	&hori_stat_attr_err_shutdown.attr.attr,
+	&hori_stat_attr_err_other.attr.attr,
+	&hori_stat_attr_submit_errors.attr.attr,
+	&hori_stat_attr_retries.attr.attr,
+	&hori_stat_attr_halts_cleared.attr.attr,
+	&hori_stat_attr_recoveries.attr.attr,
+	&hori_stat_attr_watchdog_restarts.attr.attr,
+	&hori_stat_attr_faults_injected.attr.attr,
+	&hori_stat_attr_events.attr.attr,
+	&hori_stat_attr_syncs.attr.attr,
+	NULL
+};
+
+static const struct attribute_group hori_stats_group = {
+	.name = "statistics",
+	.attrs = hori_stats_attrs,
+};
+
+static const struct attribute_group *hori_groups[] = {
+	&hori_group,
+	&hori_stats_group,
+	NULL
+};
+
+static int hori_hist_show(struct seq_file *m, void *v)
+{
+	struct hori_hist *hist = m->private;
+	unsigned int i;
+
+	seq_printf(m, "%12s %12s %12s %12s %12s\n", "ns <", "rtt", "gap",
+		   "sync", "recover");
+	for (i = 0; i < HORI_HIST_BUCKETS; i++) {
+		if (i < HORI_HIST_BUCKETS - 1)
+			seq_printf(m, "%12llu", 1ULL << i);
+		else
+			seq_printf(m, "%12s", "inf");
+		seq_printf(m, " %12lld %12lld %12lld %12lld\n",
+			   atomic64_read(&hist->bucket[HORI_HIST_RTT][i]),
+			   atomic64_read(&hist->bucket[HORI_HIST_GAP][i]),
+			   atomic64_read(&hist->bucket[HORI_HIST_SYNC][i]),
+			   atomic64_read(&hist->bucket[HORI_HIST_RECOVER][i]));
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hori_hist);
+
+static int hori_state_show(struct seq_file *m, void *v)
+{
+	struct hori *hori = m->private;
+	struct hori_state st;
+
+	hori_state_read(hori, &st);
+	seq_printf(m, "axes %u %u %u %u %u %u\n", st.axes[0], st.axes[1],
+		   st.axes[2], st.axes[3], st.axes[4], st.axes[5]);
+	seq_printf(m, "pressure %u %u\n", st.pressure[0], st.pressure[1]);
+	seq_printf(m, "buttons %04x %04x\n", st.buttons[0], st.buttons[1]);
+	seq_printf(m, "hats %u %u\n", st.hats[0], st.hats[1]);
+	seq_printf(m, "mode %u\n", st.mode);
+	seq_printf(m, "valid %x\n", st.valid);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(hori_state);
+
+/* Any write clears all histograms of the device */
+static ssize_t hori_hist_reset_write(struct file *file,
+				     const char __user *buf,
+				     size_t count, loff_t *ppos)
+{
+	struct hori *hori = file->private_data;
+	unsigned int src, type, i;
+
+	for (src = 0; src < HORI_FRAME_SOURCES; src++)
+		for (type = 0; type < HORI_HIST_TYPES; type++)
+			for (i = 0; i < HORI_HIST_BUCKETS; i++)
+				atomic64_set(&hori->hist[src].bucket[type][i], 0);
+
+	return count;
+}
+
+static const struct file_operations hori_hist_reset_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.write	= hori_hist_reset_write,
+	.llseek	= noop_llseek,
+};
+
+struct hori_ring_reader {
+	struct hori_ring	*ring;
+	u32			next;	/* sequence number to read next */
+
+	/* capture: encoder state and the bytes not read yet */
+	struct hori_capture_state cap;
+	u8			pending[HORI_CAPTURE_MAX_RECORD];
+	unsigned int		pending_len;
+	unsigned int		pending_off;
+};
+
+static int hori_ring_open(struct inode *inode, struct file *file)
+{
+	struct hori *hori = inode->i_private;
+	struct hori_ring_reader *reader;
+
+	if (!hori->ring)
+		return -ENODEV;
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	/* Live capture: start with whatever arrives after the open */
+	reader->ring = hori->ring;
+	reader->next = atomic_read(&hori->ring->head);
+	file->private_data = reader;
+
+	return nonseekable_open(inode, file);
+}
+
+static int hori_ring_release(struct inode *inode, struct file *file)
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+/*
+ * Copies the next record out of the ring. Returns 0 on success, -EAGAIN
+ * if it hasn't been written yet. A reader that got lapped skips ahead to
+ * half a ring behind the writers; the seq field shows the gap.
+ */
+static int hori_ring_fetch(struct hori_ring_reader *reader,
+			   struct hori_raw_record *rec)
+{
+	struct hori_ring *ring = reader->ring;
+	struct hori_ring_slot *slot;
+	u32 commit;
+
+	for (;;) {
+		slot = &ring->slots[reader->next & ring->mask];
+		commit = smp_load_acquire(&slot->commit);
+		if ((s32)(commit - reader->next) < 0)
+			return -EAGAIN;
+
+		if (commit == reader->next) {
+			*rec = slot->rec;
+			smp_rmb();
+			if (READ_ONCE(slot->commit) == commit) {
+				reader->next++;
+				return 0;
+			}
+		}
+
+		reader->next = atomic_read(&ring->head) - (ring->mask + 1) / 2;
+	}
+}
+
+/* Waits for a record to be written, returns an error for read() if not */
+static int hori_ring_wait(struct hori_ring_reader *reader, struct file *file)
+{
+	struct hori_ring *ring = reader->ring;
+	int error;
+
+	if (file->f_flags & O_NONBLOCK)
+		return -EAGAIN;
+
+	error = wait_event_interruptible(ring->wait,
+		READ_ONCE(ring->dead) ||
+		(s32)(atomic_read(&ring->head) - reader->next) > 0);
+	if (error)
+		return error;
+	if (READ_ONCE(ring->dead))
+		return -ENODEV;
+
+	return 0;
+}
+
+static ssize_t hori_ring_read(struct file *file, char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	struct hori_ring_reader *reader = file->private_data;
+	struct hori_raw_record rec;
+	size_t done = 0;
+	int error;
+
+	if (count < sizeof(rec))
+		return -EINVAL;
+
+	while (count - done >= sizeof(rec)) {
+		error = hori_ring_fetch(reader, &rec);
+		if (error) {
+			if (done)
+				break;
+			error = hori_ring_wait(reader, file);
+			if (error)
+				return error;
+			continue;
+		}
+
+		if (copy_to_user(buf + done, &rec, sizeof(rec)))
+			return done ?: -EFAULT;
+		done += sizeof(rec);
+	}
+
+	return done;
+}
+
+static const struct file_operations hori_ring_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hori_ring_open,
+	.release	= hori_ring_release,
+	.read		= hori_ring_read,
+	.llseek		= no_llseek,
+};
+
+static int hori_capture_open(struct inode *inode, struct file *file)
+{
+	struct hori_ring_reader *reader;
+	int error;
+
+	error = hori_ring_open(inode, file);
+	if (error)
+		return error;
+
+	reader = file->private_data;
+	memcpy(reader->pending, HORI_CAPTURE_MAGIC, HORI_CAPTURE_MAGIC_LEN);
+	reader->pending_len = HORI_CAPTURE_MAGIC_LEN;
+
+	return 0;
+}
+
+/* Same records as raw, encoded as a capture file; any read size works */
+static ssize_t hori_capture_read(struct file *file, char __user *buf,
+				 size_t count, loff_t *ppos)
+{
+	struct hori_ring_reader *reader = file->private_data;
+	struct hori_raw_record rec;
+	size_t done = 0, chunk;
+	int error;
+
+	while (done < count) {
+		if (reader->pending_off < reader->pending_len) {
+			chunk = min_t(size_t, count - done,
+				      reader->pending_len - reader->pending_off);
+			if (copy_to_user(buf + done,
+					 reader->pending + reader->pending_off,
+					 chunk))
+				return done ?: -EFAULT;
+			reader->pending_off += chunk;
+			done += chunk;
+			continue;
+		}
+
+		error = hori_ring_fetch(reader, &rec);
+		if (error) {
+			if (done)
+				break;
+			error = hori_ring_wait(reader, file);
+			if (error)
+				return error;
+			continue;
+		}
+
+		reader->pending_len = hori_capture_encode(&reader->cap, &rec,
+							  reader->pending);
+		reader->pending_off = 0;
+	}
+
+	return done;
+}
+
+static const struct file_operations hori_capture_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hori_capture_open,
+	.release	= hori_ring_release,
+	.read		= hori_capture_read,
+	.llseek		= no_llseek,
+};
+
+/*
+ * Capture replay into the virtual stick. Records go through the same
+ * dedup, frame assembly and decoding as live transfers, spaced out by
+ * their capture time divided by replay_speed.
+ */
+struct hori_replay {
+	struct hori			*hori;
+	struct hori_capture_state	cap;
+	bool				header;	/* magic seen */
+	bool				started;
+	ktime_t				start;	/* when the first record went in */
+	u64				first_ns; /* and its capture time */
+	unsigned int			len;
+	u8				buf[HORI_REPLAY_BUF];
+};
+
+static int hori_replay_open(struct inode *inode, struct file *file)
+{
+	struct hori_replay *replay;
+
+	replay = kzalloc(sizeof(*replay), GFP_KERNEL);
+	if (!replay)
+		return -ENOMEM;
+
+	replay->hori = inode->i_private;
+	file->private_data = replay;
+
+	return nonseekable_open(inode, file);
+}
+
+static int hori_replay_release(struct inode *inode, struct file *file)
+{
+	struct hori_replay *replay = file->private_data;
+	struct hori *hori = replay->hori;
+
+	/* Report a frame still waiting for its VR1 word */
+	scoped_guard(spinlock_irqsave, &hori->frame_lock) {
+		clear_bit(HORI_POLL_VR1, &hori->flags);
+		hori_frame_flush(hori);
+	}
+
+	kfree(replay);
+	return 0;
+}
+
+/* Holds @rec back until its turn; replay_speed 0 doesn't wait at all */
+static int hori_replay_wait(struct hori_replay *replay,
+			    const struct hori_raw_record *rec)
+{
+	u32 speed = READ_ONCE(replay->hori->replay_speed);
+	s64 offset;
+	ktime_t until;
+
+	if (!replay->started) {
+		replay->started = true;
+		replay->start = ktime_get();
+		replay->first_ns = rec->time_ns;
+		return 0;
+	}
+
+	offset = (s64)(rec->time_ns - replay->first_ns);
+	if (!speed || offset <= 0)
+		return 0;
+
+	until = ktime_add_ns(replay->start, div_u64(offset, speed));
+	do {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!schedule_hrtimeout_range(&until, 0, HRTIMER_MODE_ABS))
+			return 0;
+	} while (!signal_pending(current));
+
+	return -EINTR;
+}
+
+static void hori_replay_record(struct hori *hori,
+			       const struct hori_raw_record *rec)
+{
+	ktime_t now = ktime_get();
+
+	switch (rec->type) {
+	case HORI_RAW_IRQ:
+		hori_irq_report(hori, rec->data, rec->len, now);
+		break;
+	case HORI_RAW_VR0:
+		if (rec->len != sizeof(__le16))
+			break;
+		/* The timer sends both requests, so VR1 is due after this */
+		set_bit(HORI_POLL_VR1, &hori->flags);
+		hori_frame_commit(hori, HORI_FRAME_VR0, rec->data, now);
+		break;
+	case HORI_RAW_VR1:
+		if (rec->len != sizeof(__le16))
+			break;
+		clear_bit(HORI_POLL_VR1, &hori->flags);
+		hori_frame_commit(hori, HORI_FRAME_VR1, rec->data, now);
+		break;
+	}
+}
+
+/*
+ * Plays every whole record in replay->buf and drops it from the buffer.
+ * A record that waits for its turn and gets a signal stays buffered for
+ * the next write. On -EINVAL, *bad is the offset the malformed record
+ * had in the buffer before the drain; it is at the front now.
+ */
+static int hori_replay_drain(struct hori_replay *replay, unsigned int *bad)
+{
+	struct hori *hori = replay->hori;
+	struct hori_capture_state cap;
+	struct hori_raw_record rec;
+	unsigned int off = 0;
+	int used, error = 0;
+
+	if (!replay->header) {
+		if (replay->len < HORI_CAPTURE_MAGIC_LEN)
+			return 0;
+		if (memcmp(replay->buf, HORI_CAPTURE_MAGIC,
+			   HORI_CAPTURE_MAGIC_LEN)) {
+			*bad = 0;
+			return -EINVAL;
+		}
+		replay->header = true;
+		off = HORI_CAPTURE_MAGIC_LEN;
+	}
+
+	while (off < replay->len) {
+		cap = replay->cap;
+		used = hori_capture_decode(&cap, replay->buf + off,
+					   replay->len - off, &rec);
+		if (used < 0) {
+			*bad = off;
+			error = -EINVAL;
+			break;
+		}
+		if (!used)
+			break;
+		if (rec.type != HORI_CAPTURE_GAP) {
+			error = hori_replay_wait(replay, &rec);
+			if (error)
+				break;
+		}
+
+		replay->cap = cap;
+		off += used;
+		if (rec.type != HORI_CAPTURE_GAP)
+			hori_replay_record(hori, &rec);
+	}
+
+	memmove(replay->buf, replay->buf + off, replay->len - off);
+	replay->len -= off;
+
+	return error;
+}
+
+/*
+ * Writes may split records anywhere; the tail of an incomplete one is
+ * kept for the next write. A signal stops the replay early, but the
+ * bytes are accepted and the rest plays on the next write. A malformed
+ * record is taken back with everything after it, whichever write it came
+ * in: this write comes up short before it, or fails with -EINVAL.
+ */
+static ssize_t hori_replay_write(struct file *file, const char __user *ubuf,
+				 size_t count, loff_t *ppos)
+{
+	struct hori_replay *replay = file->private_data;
+	unsigned int old, bad;
+	size_t chunk;
+	int error;
+
+	guard(mutex)(&replay->hori->pm_mutex);
+
+	/* Left full by an interrupted write; make room first */
+	if (replay->len == sizeof(replay->buf)) {
+		error = hori_replay_drain(replay, &bad);
+		if (error == -EINVAL)
+			replay->len = 0;
+		if (error)
+			return error;
+		if (replay->len == sizeof(replay->buf))
+			return -ENOSPC;
+	}
+
+	old = replay->len;
+	chunk = min_t(size_t, count, sizeof(replay->buf) - old);
+	if (copy_from_user(replay->buf + old, ubuf, chunk))
+		return -EFAULT;
+	replay->len += chunk;
+
+	error = hori_replay_drain(replay, &bad);
+	if (error != -EINVAL)
+		return chunk;
+
+	/* Everything left starts at the bad record */
+	replay->len = 0;
+	if (bad <= old)
+		return -EINVAL;
+
+	return bad - old;
+}
+
+static const struct file_operations hori_replay_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hori_replay_open,
+	.release	= hori_replay_release,
+	.write		= hori_replay_write,
+	.llseek		= no_llseek,
+};
+
+static void hori_ring_free(void *_hori)
+{
+	struct hori *hori = _hori;
+
+	kvfree(hori->ring);
+}
+
+static int hori_ring_init(struct hori *hori)
+{
+	unsigned int entries, i;
+
+	if (!ring_size)
+		return 0;
+
+	entries = roundup_pow_of_two(min(ring_size, HORI_RING_MAX));
+	hori->ring = kvzalloc(struct_size(hori->ring, slots, entries),
+			      GFP_KERNEL);
+	if (!hori->ring)
+		return -ENOMEM;
+
+	atomic_set(&hori->ring->head, 0);
+	hori->ring->mask = entries - 1;
+	init_waitqueue_head(&hori->ring->wait);
+	for (i = 0; i < entries; i++)
+		hori->ring->slots[i].commit = U32_MAX;
+
+	return devm_add_action_or_reset(hori->dev, hori_ring_free, hori);
+}
+
+/*
+ * An open file holds its own reference to the page, and so does each
+ * mapping of it, so neither depends on the stick still being there.
+ */
+static int hori_shm_open(struct inode *inode, struct file *file)
+{
+	struct miscdevice *misc = file->private_data;
+	struct hori *hori = container_of(misc, struct hori, misc);
+
+	get_page(hori->shm_page);
+	file->private_data = hori->shm_page;
+
+	return 0;
+}
+
+static int hori_shm_release(struct inode *inode, struct file *file)
+{
+	put_page(file->private_data);
+	return 0;
+}
+
+static int hori_shm_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff || vma_pages(vma) != 1)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	vm_flags_clear(vma, VM_MAYWRITE);
+	vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+
+	return vm_insert_page(vma, vma->vm_start, file->private_data);
+}
+
+static const struct file_operations hori_shm_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hori_shm_open,
+	.release	= hori_shm_release,
+	.mmap		= hori_shm_mmap,
+	.llseek		= noop_llseek,
+};
+
+static void hori_shm_free(void *_hori)
+{
+	struct hori *hori = _hori;
+
+	put_page(hori->shm_page);
+}
+
+static void hori_shm_remove(void *_hori)
+{
+	struct hori *hori = _hori;
+
+	misc_deregister(&hori->misc);
+	ida_free(&hori_ida, hori->id);
+}
+
+static int hori_shm_init(struct hori *hori)
+{
+	int error;
+
+	hori->shm_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	if (!hori->shm_page)
+		return -ENOMEM;
+	hori->shm = page_address(hori->shm_page);
+
+	error = devm_add_action_or_reset(hori->dev, hori_shm_free, hori);
+	if (error)
+		return error;
+
+	hori->id = ida_alloc(&hori_ida, GFP_KERNEL);
+	if (hori->id < 0)
+		return hori->id;
+
+	snprintf(hori->misc_name, sizeof(hori->misc_name), "hori%d", hori->id);
+	hori->misc.minor = MISC_DYNAMIC_MINOR;
+	hori->misc.name = hori->misc_name;
+	hori->misc.fops = &hori_shm_fops;
+	hori->misc.parent = hori->dev;
+	hori->misc.mode = 0444;
+
+	error = misc_register(&hori->misc);
+	if (error) {
+		ida_free(&hori_ida, hori->id);
+		return error;
+	}
+
+	return devm_add_action_or_reset(hori->dev, hori_shm_remove, hori);
 }
 
-static void hori_poll_vr0(struct hori *hori);
-static void hori_poll_vr1(struct hori *hori);
+static void hori_stream_release_kref(struct kref *kref)
+{
+	kfree(container_of(kref, struct hori_stream, kref));
+}
 
-static void hori_poll_vr0_complete(struct urb *urb)
+static int hori_stream_open(struct inode *inode, struct file *file)
 {
-	struct hori *hori = urb->context;
+	struct miscdevice *misc = file->private_data;
+	struct hori_stream *stream = container_of(misc, struct hori_stream,
+						  misc);
+	struct hori_stream_reader *reader;
+	unsigned int frames = roundup_pow_of_two(raw_frames);
+
+	reader = kzalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
 
-	//printk(KERN_INFO "hori_poll_vr0_complete: %d\n", urb->status);
-	switch (urb->status) {
-	case 0:
-		break;
-	case -ETIME:
-		// this urb is timing out
-		dev_warn(&hori->intf->dev,
-			"%s - urb timed out - was the device unplugged?\n",
-			__func__);
-		return;
-	case -EPIPE:
-		// stalled
-		goto exit2;
-	case -ECONNRESET:
-	case -ENOENT:
-	case -ESHUTDOWN:
-		// this urb is terminated, clean up
-		dev_warn(&hori->intf->dev, "%s - urb shutting down with status: %d\n",
-			__func__, urb->status);
-		return;
-	default:
-		dev_err(&hori->intf->dev, "%s - nonzero urb status received: %d\n",
-			__func__, urb->status);
-		goto exit2;
+	/* Large queues need not be physically contiguous */
+	reader->buf = kvmalloc_array(frames, sizeof(*reader->buf), GFP_KERNEL);
+	if (!reader->buf) {
+		kfree(reader);
+		return -ENOMEM;
 	}
+	kfifo_init(&reader->fifo, reader->buf, frames * sizeof(*reader->buf));
 
-	input_report_key(hori->input, BTN_TRIGGER_HAPPY1, !hori->vr0.fire_c);
-	input_report_key(hori->input, BTN_TRIGGER_HAPPY2, !hori->vr0.button_d);
-	input_report_key(hori->input, BTN_TRIGGER_HAPPY3, !hori->vr0.hat);
-	input_report_key(hori->input, BTN_TRIGGER_HAPPY4, !hori->vr0.button_st);
-
-	input_report_key(hori->input, BTN_TRIGGER_HAPPY5, !hori->vr0.dpad1_top);
-	input_report_key(hori->input, BTN_TRIGGER_HAPPY6, !hori->vr0.dpad1_right);
-	input_report_key(hori->input, BTN_TRIGGER_HAPPY7, !hori->vr0.dpad1_bottom);
-	input_report_key(hori->input, BTN_TRIGGER_HAPPY8, !hori->vr0.dpad1_left);
-/*
-	input_report_abs(hori->input, ABS_TILT_X, !hori->vr0.dpad1_left ? 0 : !hori->vr0.dpad1_right ? 2 : 1);
-	input_report_abs(hori->input, ABS_TILT_Y, !hori->vr0.dpad1_top ? 0 : !hori->vr0.dpad1_bottom ? 2 : 1);
-*/
-	input_report_key(hori->input, BTN_THUMB, !hori->vr0.launch);
-	input_report_key(hori->input, BTN_TRIGGER, !hori->vr0.trigger);
+	mutex_init(&reader->read_mutex);
+	reader->stream = stream;
 
-	/*
-	printk(KERN_INFO "hori: data: 1:%x 2:%x 3:%x 4:%x 5:%x 6:%x\n",
-		hori->vr0.reserved1, hori->vr0.reserved2, hori->vr0.reserved3,
-		hori->vr0.reserved4, hori->vr0.reserved5, hori->vr0.reserved6);
-		*/
-/*
-	dev_info(&hori->intf->dev, "%u %u %u %u %u %u %u %u %u %u\n",
-			hori->vr0.fire_c, hori->vr0.button_d, hori->vr0.hat, hori->vr0.button_st,
-			hori->vr0.dpad1_top, hori->vr0.dpad1_right, hori->vr0.dpad1_bottom, hori->vr0.dpad1_left,
-			hori->vr0.launch, hori->vr0.trigger);
-*/
-	input_sync(hori->input);
+	spin_lock_irq(&stream->lock);
+	if (stream->nr_readers == HORI_STREAM_READERS_MAX) {
+		spin_unlock_irq(&stream->lock);
+		kvfree(reader->buf);
+		kfree(reader);
+		return -EBUSY;
+	}
+	stream->nr_readers++;
+	list_add_tail(&reader->node, &stream->readers);
+	kref_get(&stream->kref);
+	spin_unlock_irq(&stream->lock);
 
-exit2:
-	hori_poll_vr1(hori);
+	file->private_data = reader;
+	return stream_open(inode, file);
 }
 
-static void hori_poll_vr0(struct hori *hori)
+static int hori_stream_release(struct inode *inode, struct file *file)
 {
-	struct usb_device *udev = interface_to_usbdev(hori->intf);
+	struct hori_stream_reader *reader = file->private_data;
+	struct hori_stream *stream = reader->stream;
 
-	hori->ctl_req->bRequest = HORI_POLL_VR0;
-        hori->ctl_req->wLength = sizeof(hori->vr0);
+	spin_lock_irq(&stream->lock);
+	list_del(&reader->node);
+	stream->nr_readers--;
+	spin_unlock_irq(&stream->lock);
 
-	usb_fill_control_urb( hori->urb_ctl, udev,
-			usb_rcvctrlpipe(udev, 0),
-			(unsigned char *)hori->ctl_req,
-			&hori->vr0, sizeof(hori->vr0),
-			hori_poll_vr0_complete, hori);
-/*
-	dev_warn(&hori->intf->dev,
-		"%s - usb_submit_urb\n",
-		__func__);
-		*/
-	int error = usb_submit_urb(hori->urb_ctl, GFP_KERNEL);
-	if (error && error != -EPERM)
-		hori_urb_error(&hori->intf->dev, error);
+	kvfree(reader->buf);
+	kfree(reader);
+	kref_put(&stream->kref, hori_stream_release_kref);
+	return 0;
 }
 
-static void hori_poll_vr1_complete(struct urb *urb)
+static ssize_t hori_stream_read(struct file *file, char __user *buf,
+				size_t count, loff_t *ppos)
 {
-	struct hori *hori = urb->context;
+	struct hori_stream_reader *reader = file->private_data;
+	struct hori_stream *stream = reader->stream;
+	unsigned int copied;
+	int error;
 
-	//printk(KERN_INFO "hori_poll_vr1_complete: %d\n", urb->status);
-	switch (urb->status) {
-	case 0:
-		break;
-	case -ETIME:
-		// this urb is timing out
-		dev_warn(&hori->intf->dev,
-			"%s - urb timed out - was the device unplugged?\n",
-			__func__);
-		return;
-	case -EPIPE:
-		// stalled
-		goto exit3;
-	case -ECONNRESET:
-	case -ENOENT:
-	case -ESHUTDOWN:
-		// this urb is terminated, clean up
-		dev_warn(&hori->intf->dev, "%s - urb shutting down with status: %d\n",
-			__func__, urb->status);
-		return;
-	default:
-		dev_err(&hori->intf->dev, "%s - nonzero urb status received: %d\n",
-			__func__, urb->status);
-		goto exit3;
+	if (count < sizeof(struct hori_frame_record))
+		return -EINVAL;
+
+	if (mutex_lock_interruptible(&reader->read_mutex))
+		return -ERESTARTSYS;
+
+	while (kfifo_is_empty(&reader->fifo)) {
+		if (READ_ONCE(stream->dead)) {
+			error = -ENODEV;
+			goto out;
+		}
+		if (file->f_flags & O_NONBLOCK) {
+			error = -EAGAIN;
+			goto out;
+		}
+		error = wait_event_interruptible(stream->wait,
+			READ_ONCE(stream->dead) ||
+			!kfifo_is_empty(&reader->fifo));
+		if (error)
+			goto out;
 	}
-/*
-	printk(KERN_INFO "hori: data: 1:%x 2:%x 3:%x 4:%x 5:%x 6:%x\n",
-		hori->vr1.reserved1, hori->vr1.reserved2, hori->vr1.reserved3,
-		hori->vr1.reserved4, hori->vr1.reserved5, hori->vr1.reserved6);
-*/
-	input_report_key(hori->input, BTN_THUMB2, !hori->vr1.dpad3_right);
-	input_report_key(hori->input, BTN_C, !hori->vr1.dpad3_middle);
-	input_report_key(hori->input, BTN_X, !hori->vr1.dpad3_left);
-	input_report_key(hori->input, BTN_Y, !hori->vr1.button_sw1);
 
-/*
-	// TODO: mode_select
-	input_report_key(hori->input, BTN_BASE, hori->vr1.mode_select == 1);
-	input_report_key(hori->input, BTN_GEAR_UP, hori->vr1.mode_select == 2);
-	input_report_key(hori->input, BTN_GEAR_DOWN, hori->vr1.mode_select == 3);
-*/
+	/* as many whole frames as fit; copied is in bytes */
+	error = kfifo_to_user(&reader->fifo, buf, count, &copied);
+	if (!error)
+		error = copied;
+out:
+	mutex_unlock(&reader->read_mutex);
+	return error;
+}
 
-	input_report_abs(hori->input, ABS_Z, !hori->vr1.dpad2_left ? 0 : !hori->vr1.dpad2_right ? 2 : 1);
-	input_report_abs(hori->input, ABS_RZ, !hori->vr1.dpad2_top ? 0 : !hori->vr1.dpad2_bottom ? 2 : 1);
-	/*
-	input_report_key(hori->input, BTN_Z, !hori->vr1.dpad2_bottom);
-	input_report_key(hori->input, BTN_TL, !hori->vr1.dpad2_left);
-	input_report_key(hori->input, BTN_TR, !hori->vr1.dpad2_top);
-	input_report_key(hori->input, BTN_MODE, !hori->vr1.dpad2_right);
-*/
-	input_sync(hori->input);
+static __poll_t hori_stream_poll(struct file *file, poll_table *wait)
+{
+	struct hori_stream_reader *reader = file->private_data;
+	struct hori_stream *stream = reader->stream;
+	__poll_t mask = 0;
 
-exit3:
-	hori_poll_vr0(hori);
+	poll_wait(file, &stream->wait, wait);
+	if (!kfifo_is_empty(&reader->fifo))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (READ_ONCE(stream->dead))
+		mask |= EPOLLHUP | EPOLLERR;
+
+	return mask;
 }
 
-static void hori_poll_vr1(struct hori *hori)
+static const struct file_operations hori_stream_fops = {
+	.owner		= THIS_MODULE,
+	.open		= hori_stream_open,
+	.release	= hori_stream_release,
+	.read		= hori_stream_read,
+	.poll		= hori_stream_poll,
+	.llseek		= no_llseek,
+};
+
+/*
+ * Runs before hori_shm_remove() frees the id. Readers still open keep the
+ * stream; they drain what is queued, then get -ENODEV.
+ */
+static void hori_stream_remove(void *_hori)
 {
-	struct usb_device *udev = interface_to_usbdev(hori->intf);
+	struct hori *hori = _hori;
+	struct hori_stream *stream = hori->stream;
 
-	hori->ctl_req->bRequest = HORI_POLL_VR1;
-        hori->ctl_req->wLength = sizeof(hori->vr1);
+	misc_deregister(&stream->misc);
 
-	usb_fill_control_urb( hori->urb_ctl, udev,
-			usb_rcvctrlpipe(udev, 0),
-			(unsigned char *)hori->ctl_req,
-			&hori->vr1, sizeof(hori->vr1),
-			hori_poll_vr1_complete, hori);
-/*
-	dev_warn(&hori->intf->dev,
-		"%s - usb_submit_urb\n",
-		__func__);
-		*/
-	int error = usb_submit_urb(hori->urb_ctl, GFP_KERNEL);
-	if (error && error != -EPERM)
-		hori_urb_error(&hori->intf->dev, error);
+	scoped_guard(spinlock_irqsave, &hori->frame_lock)
+		hori->stream = NULL;
+
+	WRITE_ONCE(stream->dead, true);
+	wake_up_interruptible_poll(&stream->wait, EPOLLHUP | EPOLLERR);
+	kref_put(&stream->kref, hori_stream_release_kref);
 }
 
-static void hori_usb_irq(struct urb *urb)
+/* /dev/hori-raw<id>; takes the id from hori_shm_init() */
+static int hori_stream_init(struct hori *hori)
 {
-	struct hori *hori = urb->context;
-	u8 *data = urb->transfer_buffer;
+	struct hori_stream *stream;
 	int error;
 
-	switch (urb->status) {
-	case 0:
-		/* success */
-		break;
-	case -ETIME:
-		/* this urb is timing out */
-		dev_dbg(&hori->intf->dev,
-			"%s - urb timed out - was the device unplugged?\n",
-			__func__);
-		return;
-	case -ECONNRESET:
-	case -ENOENT:
-	case -ESHUTDOWN:
-	case -EPIPE:
-		/* this urb is terminated, clean up */
-		dev_dbg(&hori->intf->dev, "%s - urb shutting down with status: %d\n",
-			__func__, urb->status);
-		return;
-	default:
-		dev_dbg(&hori->intf->dev, "%s - nonzero urb status received: %d\n",
-			__func__, urb->status);
-		goto exit;
-	}
-
-	if (urb->actual_length == 8) {
-		input_report_abs(hori->input, ABS_X, data[0]);
-		input_report_abs(hori->input, ABS_Y, data[1]);
-		input_report_abs(hori->input, ABS_RUDDER, data[2]);
-		input_report_abs(hori->input, ABS_RX, data[3]);
-		input_report_abs(hori->input, ABS_RY, data[4]);
-		input_report_abs(hori->input, ABS_THROTTLE, data[5]);
+	stream = kzalloc(sizeof(*stream), GFP_KERNEL);
+	if (!stream)
+		return -ENOMEM;
 
-		input_report_key(hori->input, BTN_A, data[6] < 0xc0);
-		input_report_key(hori->input, BTN_B, data[7] < 0xc0);
+	kref_init(&stream->kref);
+	spin_lock_init(&stream->lock);
+	INIT_LIST_HEAD(&stream->readers);
+	init_waitqueue_head(&stream->wait);
 
-		//printk(KERN_INFO "hori: data: %x %x\n", data[6], data[7]);
+	snprintf(stream->name, sizeof(stream->name), "hori-raw%d", hori->id);
+	stream->misc.minor = MISC_DYNAMIC_MINOR;
+	stream->misc.name = stream->name;
+	stream->misc.fops = &hori_stream_fops;
+	stream->misc.parent = hori->dev;
+	stream->misc.mode = 0440;
 
-		input_sync(hori->input);
-	} else {
-		dev_warn(&hori->intf->dev,
-			"%s - urb->actual_length == %d\n",
-			__func__, urb->actual_length);
+	error = misc_register(&stream->misc);
+	if (error) {
+		kfree(stream);
+		return error;
 	}
 
-exit:
-	/* Resubmit to fetch new fresh URBs */
-	error = usb_submit_urb(urb, GFP_ATOMIC);
-	if (error && error != -EPERM)
-		hori_urb_error(&hori->intf->dev, error);
+	hori->stream = stream;
+	return devm_add_action_or_reset(hori->dev, hori_stream_remove, hori);
 }
 
-static int hori_open(struct input_dev *input)
+static void hori_debugfs_remove(void *_hori)
 {
-	struct hori *hori = input_get_drvdata(input);
-	int error;
+	struct hori *hori = _hori;
 
-	guard(mutex)(&hori->pm_mutex);
-	error = usb_submit_urb(hori->urb, GFP_KERNEL);
-	if (error) {
-		dev_err(&hori->intf->dev,
-			"%s - usb_submit_urb failed, error: %d\n",
-			__func__, error);
-		return -EIO;
+	/* Blocked raw readers would hold up the removal otherwise */
+	if (hori->ring) {
+		WRITE_ONCE(hori->ring->dead, true);
+		wake_up_interruptible(&hori->ring->wait);
 	}
 
-	hori->is_open = true;
-	hori_poll_vr0(hori);
-
-	return 0;
+	debugfs_remove_recursive(hori->debugfs);
 }
 
-static void hori_close(struct input_dev *input)
+static int hori_debugfs_init(struct hori *hori)
 {
-	struct hori *hori = input_get_drvdata(input);
+	struct dentry *dir;
+
+	dir = debugfs_create_dir(dev_name(hori->dev), hori_debugfs_root);
+	hori->debugfs = dir;
+
+	debugfs_create_file("vr0", 0444, dir, &hori->hist[HORI_FRAME_VR0],
+			    &hori_hist_fops);
+	debugfs_create_file("vr1", 0444, dir, &hori->hist[HORI_FRAME_VR1],
+			    &hori_hist_fops);
+	debugfs_create_file("irq", 0444, dir, &hori->hist[HORI_FRAME_IRQ],
+			    &hori_hist_fops);
+	debugfs_create_file("reset", 0200, dir, hori, &hori_hist_reset_fops);
+	debugfs_create_file("state", 0444, dir, hori, &hori_state_fops);
+	debugfs_create_file("raw", 0400, dir, hori, &hori_ring_fops);
+	debugfs_create_file("capture", 0400, dir, hori, &hori_capture_fops);
+
+	if (hori->intf) {
+		hori_fault_init(hori, dir);
+	} else {
+		debugfs_create_file("replay", 0200, dir, hori, &hori_replay_fops);
+		debugfs_create_u32("replay_speed", 0600, dir,
+				   &hori->replay_speed);
+	}
 
-	dev_warn(&hori->intf->dev,
-		"%s - usb_kill_urb\n",
-		__func__);
-	guard(mutex)(&hori->pm_mutex);
-	usb_kill_urb(hori->urb);
-	usb_kill_urb(hori->urb_ctl);
-	hori->is_open = false;
+	return devm_add_action_or_reset(hori->dev, hori_debugfs_remove,
+					hori);
 }
 
-static void hori_free_urb(void *_hori)
+/* The input device and its capabilities; the caller fills phys and id */
+static int hori_input_init(struct hori *hori)
 {
-	struct hori *hori = _hori;
+	unsigned int bit;
+	int i;
 
-	dev_warn(&hori->intf->dev,
-		"%s - usb_free_urb\n",
-		__func__);
-	usb_free_urb(hori->urb);
-	usb_free_urb(hori->urb_ctl);
-}
+	hori->input = devm_input_allocate_device(hori->dev);
+	if (!hori->input) {
+		dev_err(hori->dev, "couldn't allocate input device\n");
+		return -ENOMEM;
+	}
+
+	hori->input->name = "Mitsubishi Hori/Namco Flightstick";
+	hori->input->phys = hori->phys;
+
+	for (i = 0; i < ARRAY_SIZE(hori_irq_axes); i++)
+		input_set_abs_params(hori->input, hori_irq_axes[i], 0, 255, 0, 0);
+	//input_set_abs_params(hori->input, ABS_TILT_X, 0, 3, 0, 0);
+	//input_set_abs_params(hori->input, ABS_TILT_Y, 0, 3, 0, 0);
+
+	for (i = 0; i < ARRAY_SIZE(hori_irq_keys); i++)
+		input_set_capability(hori->input, EV_KEY, hori_irq_keys[i]);
+
+	for (i = 0; i < HORI_VR_COUNT; i++)
+		for (bit = 0; bit < HORI_VR_BITS; bit++)
+			if (hori_vr_keys[i][bit])
+				input_set_capability(hori->input, EV_KEY,
+						     hori_vr_keys[i][bit]);
+
+	for (i = 0; i < ARRAY_SIZE(hori_vr_axes); i++)
+		input_set_abs_params(hori->input, hori_vr_axes[i].code, 0, 3, 0, 0);
+
+	hori_decoder_init(&hori->dec);
+/*
+	input_set_capability(hori->input, EV_KEY, BTN_Z);
+	input_set_capability(hori->input, EV_KEY, BTN_TL);
+	input_set_capability(hori->input, EV_KEY, BTN_TR);
+	input_set_capability(hori->input, EV_KEY, BTN_MODE);
+*/
+	//input_set_abs_params(hori->input, ABS_MISC, 0, 255, 0, 0);
 
+	input_set_drvdata(hori->input, hori);
+
+	return 0;
+}
 
 static int hori_probe(struct usb_interface *intf,
 		      const struct usb_device_id *id)
@@ -390,9 +2403,8 @@ static int hori_probe(struct usb_interface *intf,
 	struct usb_device *udev = interface_to_usbdev(intf);
 	struct hori *hori;
 	struct usb_endpoint_descriptor *epirq;
-	size_t xfer_size;
-	void *xfer_buf;
-	int error;
+	struct usb_ctrlrequest *req;
+	int error, i;
 
 	/*
 	 * Locate the endpoint information.
@@ -409,106 +2421,106 @@ static int hori_probe(struct usb_interface *intf,
 		return -ENOMEM;
 
 	mutex_init(&hori->pm_mutex);
+	spin_lock_init(&hori->frame_lock);
+	seqcount_spinlock_init(&hori->state_seq, &hori->frame_lock);
+	hori->dev = &intf->dev;
 	hori->intf = intf;
 	hori->epirq = epirq;
+	hori->poll_rate = min_t(unsigned int, poll_rate, HORI_POLL_RATE_MAX);
+	hori->irq_count = clamp_t(unsigned int, irq_urbs, 1, HORI_IRQ_URBS_MAX);
+	hori->irq_interval = min_t(unsigned int, irq_interval, HORI_IRQ_INTERVAL_MAX);
+	init_usb_anchor(&hori->irq_anchor);
+	INIT_DELAYED_WORK(&hori->irq_retry, hori_irq_retry_work);
+	INIT_DELAYED_WORK(&hori->watchdog, hori_watchdog_work);
+
+	hrtimer_init(&hori->poll_timer, CLOCK_MONOTONIC, HORI_POLL_TIMER_MODE);
+	hori->poll_timer.function = hori_poll_timer;
 
 	usb_set_intfdata(hori->intf, hori);
 
-	xfer_size = usb_endpoint_maxp(epirq);
-	xfer_buf = devm_kmalloc(&intf->dev, xfer_size, GFP_KERNEL);
-	if (!xfer_buf)
-		return -ENOMEM;
+	error = devm_add_action_or_reset(&intf->dev, hori_free_urb, hori);
+	if (error)
+		return error;
 
-	hori->urb = usb_alloc_urb(0, GFP_KERNEL);
-	if (!hori->urb)
-		return -ENOMEM;
+	/*
+	 * Transfer buffers live in coherent memory so submits skip the DMA
+	 * map/unmap, and they stay off the cachelines of struct hori.
+	 */
+	hori->irq_len = usb_endpoint_maxp(epirq);
+	for (i = 0; i < hori->irq_count; i++) {
+		struct hori_irq *irq = &hori->irq[i];
 
-	hori->ctl_req = devm_kzalloc(&intf->dev, sizeof(struct usb_ctrlrequest), GFP_KERNEL);
-	if (!hori->ctl_req)
-		return -ENOMEM;
+		irq->hori = hori;
+		irq->urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!irq->urb)
+			return -ENOMEM;
 
-	//hori->ctl_req->bRequest = USB_REQ_GET_STATUS;
-	hori->ctl_req->bRequestType = USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_ENDPOINT;
-	hori->ctl_req->wValue = 0;
-        hori->ctl_req->wIndex = 1;
+		irq->buf = usb_alloc_coherent(udev, hori->irq_len, GFP_KERNEL,
+					      &irq->dma);
+		if (!irq->buf)
+			return -ENOMEM;
 
-	hori->ctl_req->bRequest = HORI_POLL_VR0;
-        hori->ctl_req->wLength = sizeof(hori->vr0);
+		hori_fill_irq(hori, irq);
+	}
 
-	hori->urb_ctl = usb_alloc_urb(0, GFP_KERNEL);
-	if (!hori->urb_ctl)
+	hori->vr = usb_alloc_coherent(udev, HORI_VR_COUNT * sizeof(*hori->vr),
+				      GFP_KERNEL, &hori->vr_dma);
+	if (!hori->vr)
 		return -ENOMEM;
 
-	error = devm_add_action_or_reset(&intf->dev, hori_free_urb, hori);
-	if (error)
-		return error;
-
-	usb_fill_int_urb(hori->urb, udev,
-			 usb_rcvintpipe(udev, epirq->bEndpointAddress),
-			 xfer_buf, xfer_size, hori_usb_irq, hori, epirq->bInterval); // TODO: maybe 1 instead of bInterval?
-
-	hori->input = devm_input_allocate_device(&intf->dev);
-	if (!hori->input) {
-		dev_err(&intf->dev, "couldn't allocate input device\n");
-		return -ENOMEM;
+	for (i = 0; i < HORI_VR_COUNT; i++) {
+		hori->ctl[i].hori = hori;
+		hori->ctl[i].vr = i;
+		INIT_DELAYED_WORK(&hori->ctl[i].retry, hori_vr_retry_work);
+		hori->ctl[i].urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!hori->ctl[i].urb)
+			return -ENOMEM;
+
+		req = devm_kzalloc(&intf->dev, sizeof(*req), GFP_KERNEL);
+		if (!req)
+			return -ENOMEM;
+
+		req->bRequestType = USB_DIR_IN | USB_TYPE_VENDOR | USB_RECIP_ENDPOINT;
+		req->bRequest = i;
+		req->wValue = 0;
+		req->wIndex = cpu_to_le16(1);
+		req->wLength = cpu_to_le16(sizeof(hori->vr[i]));
+		hori->ctl[i].req = req;
+
+		usb_fill_control_urb(hori->ctl[i].urb, udev,
+				     usb_rcvctrlpipe(udev, 0), (unsigned char *)req,
+				     &hori->vr[i], sizeof(hori->vr[i]),
+				     hori_poll_vr_complete, &hori->ctl[i]);
+		hori->ctl[i].urb->transfer_dma = hori->vr_dma + i * sizeof(*hori->vr);
+		hori->ctl[i].urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
 	}
 
-	hori->input->name = "Mitsubishi Hori/Namco Flightstick";
+	error = hori_input_init(hori);
+	if (error)
+		return error;
 
 	usb_make_path(udev, hori->phys, sizeof(hori->phys));
 	strlcat(hori->phys, "/input0", sizeof(hori->phys));
-	hori->input->phys = hori->phys;
-
 	usb_to_input_id(udev, &hori->input->id);
 
 	hori->input->open = hori_open;
 	hori->input->close = hori_close;
 
-	input_set_abs_params(hori->input, ABS_X, 0, 255, 0, 0);
-	input_set_abs_params(hori->input, ABS_Y, 0, 255, 0, 0);
-	input_set_abs_params(hori->input, ABS_RX, 0, 255, 0, 0);
-	input_set_abs_params(hori->input, ABS_RY, 0, 255, 0, 0);
-	input_set_abs_params(hori->input, ABS_THROTTLE, 0, 255, 0, 0);
-	input_set_abs_params(hori->input, ABS_RUDDER, 0, 255, 0, 0);
-	//input_set_abs_params(hori->input, ABS_TILT_X, 0, 3, 0, 0);
-	//input_set_abs_params(hori->input, ABS_TILT_Y, 0, 3, 0, 0);
-	input_set_abs_params(hori->input, ABS_Z, 0, 3, 0, 0);
-	input_set_abs_params(hori->input, ABS_RZ, 0, 3, 0, 0);
-
-	input_set_capability(hori->input, EV_KEY, BTN_TRIGGER_HAPPY1);
-	input_set_capability(hori->input, EV_KEY, BTN_TRIGGER_HAPPY2);
-	input_set_capability(hori->input, EV_KEY, BTN_TRIGGER_HAPPY3);
-	input_set_capability(hori->input, EV_KEY, BTN_TRIGGER_HAPPY4);
-
-	input_set_capability(hori->input, EV_KEY, BTN_TRIGGER_HAPPY5);
-	input_set_capability(hori->input, EV_KEY, BTN_TRIGGER_HAPPY6);
-	input_set_capability(hori->input, EV_KEY, BTN_TRIGGER_HAPPY7);
-	input_set_capability(hori->input, EV_KEY, BTN_TRIGGER_HAPPY8);
-
-	input_set_capability(hori->input, EV_KEY, BTN_TRIGGER);
-	input_set_capability(hori->input, EV_KEY, BTN_THUMB);
-	input_set_capability(hori->input, EV_KEY, BTN_THUMB2);
-	input_set_capability(hori->input, EV_KEY, BTN_A);
-	input_set_capability(hori->input, EV_KEY, BTN_B);
-	input_set_capability(hori->input, EV_KEY, BTN_C);
-	input_set_capability(hori->input, EV_KEY, BTN_X);
-	input_set_capability(hori->input, EV_KEY, BTN_Y);
-	
-	/* MODE switch, not currently used. Gotta make it Press/Unpress or something?
-	 *
-	input_set_capability(hori->input, EV_KEY, BTN_BASE);
-	input_set_capability(hori->input, EV_KEY, BTN_GEAR_UP);
-	input_set_capability(hori->input, EV_KEY, BTN_GEAR_DOWN);
-	*/
-/*
-	input_set_capability(hori->input, EV_KEY, BTN_Z);
-	input_set_capability(hori->input, EV_KEY, BTN_TL);
-	input_set_capability(hori->input, EV_KEY, BTN_TR);
-	input_set_capability(hori->input, EV_KEY, BTN_MODE);
-*/
-	//input_set_abs_params(hori->input, ABS_MISC, 0, 255, 0, 0);
+	error = hori_ring_init(hori);
+	if (error)
+		return error;
 
-	input_set_drvdata(hori->input, hori);
+	error = hori_shm_init(hori);
+	if (error)
+		return error;
+
+	error = hori_stream_init(hori);
+	if (error)
+		return error;
+
+	error = hori_debugfs_init(hori);
+	if (error)
+		return error;
 
 	error = input_register_device(hori->input);
 	if (error)
@@ -526,13 +2538,13 @@ static int hori_suspend(struct usb_interface *intf, pm_message_t message)
 {
 	struct hori *hori = usb_get_intfdata(intf);
 
-	dev_warn(&hori->intf->dev,
+	dev_warn(hori->dev,
 		"%s - usb_kill_urb\n",
 		__func__);
 	guard(mutex)(&hori->pm_mutex);
 	if (hori->is_open) {
-		usb_kill_urb(hori->urb);
-		usb_kill_urb(hori->urb_ctl);
+		hori_stop_irq(hori);
+		hori_stop_poll(hori);
 	}
 
 	return 0;
@@ -543,13 +2555,11 @@ static int hori_resume(struct usb_interface *intf)
 	struct hori *hori = usb_get_intfdata(intf);
 
 	guard(mutex)(&hori->pm_mutex);
-	if (hori->is_open && usb_submit_urb(hori->urb, GFP_KERNEL) < 0)
+	if (hori->is_open && hori_start_irq(hori) < 0)
 		return -EIO;
 
-	if (hori->is_open) {
-		hori_poll_vr0(hori);
-		//hori_poll_vr1(hori->input);
-	}
+	if (hori->is_open)
+		hori_start_poll(hori);
 
 	return 0;
 }
@@ -558,12 +2568,12 @@ static int hori_pre_reset(struct usb_interface *intf)
 {
 	struct hori *hori = usb_get_intfdata(intf);
 
-	dev_warn(&hori->intf->dev,
+	dev_warn(hori->dev,
 		"%s - usb_kill_urb\n",
 		__func__);
 	mutex_lock(&hori->pm_mutex);
-	usb_kill_urb(hori->urb);
-	usb_kill_urb(hori->urb_ctl);
+	hori_stop_irq(hori);
+	hori_stop_poll(hori);
 	return 0;
 }
 
@@ -572,13 +2582,11 @@ static int hori_post_reset(struct usb_interface *intf)
 	struct hori *hori = usb_get_intfdata(intf);
 	int retval = 0;
 
-	if (hori->is_open && usb_submit_urb(hori->urb, GFP_KERNEL) < 0)
+	if (hori->is_open && hori_start_irq(hori) < 0)
 		retval = -EIO;
 
-	if (hori->is_open) {
-		hori_poll_vr0(hori);
-		//hori_poll_vr1(hori->input);
-	}
+	if (hori->is_open)
+		hori_start_poll(hori);
 
 	mutex_unlock(&hori->pm_mutex);
 
@@ -601,6 +2609,7 @@ static struct usb_driver hori_driver = {
 	.probe =	hori_probe,
 	.disconnect =	hori_disconnect,
 	.id_table =	hori_table,
+	.dev_groups =	hori_groups,
 	.suspend	= hori_suspend,
 	.resume		= hori_resume,
 	.pre_reset	= hori_pre_reset,
@@ -608,7 +2617,138 @@ static struct usb_driver hori_driver = {
 	.reset_resume	= hori_reset_resume,
 };
 
-module_usb_driver(hori_driver);
+/*
+ * A stick without USB behind it, fed only by the debugfs replay file, so
+ * the decode path can be exercised on machines without the hardware.
+ */
+static int hori_virtual_probe(struct platform_device *pdev)
+{
+	struct hori *hori;
+	int error;
+
+	hori = devm_kzalloc(&pdev->dev, sizeof(*hori), GFP_KERNEL);
+	if (!hori)
+		return -ENOMEM;
+
+	mutex_init(&hori->pm_mutex);
+	spin_lock_init(&hori->frame_lock);
+	seqcount_spinlock_init(&hori->state_seq, &hori->frame_lock);
+	hori->dev = &pdev->dev;
+	hori->replay_speed = 1;
+	platform_set_drvdata(pdev, hori);
+
+	error = hori_input_init(hori);
+	if (error)
+		return error;
+
+	snprintf(hori->phys, sizeof(hori->phys), "%s/input0",
+		 dev_name(&pdev->dev));
+	hori->input->id.bustype = BUS_VIRTUAL;
+	hori->input->id.vendor = HORI_VENDOR_ID;
+	hori->input->id.product = HORI_PRODUCT_ID;
+
+	error = hori_shm_init(hori);
+	if (error)
+		return error;
+
+	error = hori_stream_init(hori);
+	if (error)
+		return error;
+
+	error = hori_debugfs_init(hori);
+	if (error)
+		return error;
+
+	return input_register_device(hori->input);
+}
+
+static struct platform_driver hori_virtual_driver = {
+	.probe	= hori_virtual_probe,
+	.driver	= {
+		.name	= "hori-virtual",
+	},
+};
+
+static struct platform_device *hori_virtual_pdev;
+
+static int hori_virtual_init(void)
+{
+	int error;
+
+	if (!virtual_stick)
+		return 0;
+
+	error = platform_driver_register(&hori_virtual_driver);
+	if (error)
+		return error;
+
+	hori_virtual_pdev = platform_device_register_simple("hori-virtual",
+							     PLATFORM_DEVID_NONE,
+							     NULL, 0);
+	if (IS_ERR(hori_virtual_pdev)) {
+		platform_driver_unregister(&hori_virtual_driver);
+		return PTR_ERR(hori_virtual_pdev);
+	}
+
+	return 0;
+}
+
+static void hori_virtual_exit(void)
+{
+	if (!virtual_stick)
+		return;
+
+	platform_device_unregister(hori_virtual_pdev);
+	platform_driver_unregister(&hori_virtual_driver);
+}
+
+static int __init hori_init(void)
+{
+	int error;
+
+	if (raw_frames < 2 || raw_frames > HORI_RAW_FRAMES_MAX) {
+		pr_err("hori: raw_frames must be 2-%u\n", HORI_RAW_FRAMES_MAX);
+		return -EINVAL;
+	}
+
+	hori_wq = alloc_workqueue("hori", WQ_HIGHPRI, 0);
+	if (!hori_wq)
+		return -ENOMEM;
+
+	hori_debugfs_root = debugfs_create_dir("hori", NULL);
+
+	error = usb_register(&hori_driver);
+	if (error)
+		goto err_debugfs;
+
+	error = hori_virtual_init();
+	if (error)
+		goto err_usb;
+
+	return 0;
+
+err_usb:
+	usb_deregister(&hori_driver);
+err_debugfs:
+	debugfs_remove_recursive(hori_debugfs_root);
+	destroy_workqueue(hori_wq);
+	return error;
+}
+module_init(hori_init);
+
+static void __exit hori_exit(void)
+{
+	hori_virtual_exit();
+	usb_deregister(&hori_driver);
+	debugfs_remove_recursive(hori_debugfs_root);
+	destroy_workqueue(hori_wq);
+	ida_destroy(&hori_ida);
+}
+module_exit(hori_exit);
+
+#if IS_ENABLED(CONFIG_HORI_KUNIT_TEST)
+#include "hori_test.c"
+#endif
 
 MODULE_AUTHOR("Daniel O'Neill <daniel@oneill.app>");
 MODULE_DESCRIPTION("Mitsubishi Hori/Namco Flightstick");
@@ -0,0 +1,245 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Report layout and decoding of the Hori/Namco Flightstick
+ *
+ * Shared by hori.c and the userspace tools, so it only uses uapi headers.
+ * Before including it, define HORI_EMIT(ctx, type, code, value) to deliver
+ * one decoded event; ctx is whatever the caller passes to the decoders.
+ *
+ * Copyright (C) 2024 Daniel O'Neill <daniel@oneill.app>
+ */
+
+#ifndef _HORI_REPORT_H
+#define _HORI_REPORT_H
+
+#include <linux/input-event-codes.h>
+#include <linux/types.h>
+
+#include "hori_uapi.h"
+
+#define HORI_POLL_VR0		0x00
+#define HORI_POLL_VR1		0x01
+#define HORI_VR_COUNT		2
+
+/*
+ * Interrupt report: six axes, one byte each, then the pressure of the A
+ * and B buttons.
+ */
+#define HORI_IRQ_REPORT_LEN	8
+#define HORI_IRQ_AXES		6
+#define HORI_IRQ_PRESSED	0xc0	/* pressure below this is a press */
+
+static const __u16 hori_irq_axes[HORI_IRQ_AXES] = {
+	ABS_X, ABS_Y, ABS_RUDDER, ABS_RX, ABS_RY, ABS_THROTTLE,
+};
+
+static const __u16 hori_irq_keys[HORI_IRQ_REPORT_LEN - HORI_IRQ_AXES] = {
+	BTN_A, BTN_B,
+};
+
+/*
+ * Both vendor requests return a little-endian 16-bit word. Buttons are
+ * active low.
+ */
+
+/* input: vendor request 0x00 */
+#define HORI_VR0_FIRE_C		0	/* button fire-c */
+#define HORI_VR0_BUTTON_D	1	/* button D */
+#define HORI_VR0_HAT		2	/* hat press */
+#define HORI_VR0_BUTTON_ST	3	/* button ST */
+#define HORI_VR0_DPAD1_TOP	4	/* d-pad 1 top */
+#define HORI_VR0_DPAD1_RIGHT	5	/* d-pad 1 right */
+#define HORI_VR0_DPAD1_BOTTOM	6	/* d-pad 1 bottom */
+#define HORI_VR0_DPAD1_LEFT	7	/* d-pad 1 left */
+/* bits 8-12 reserved */
+#define HORI_VR0_LAUNCH		13	/* button launch */
+#define HORI_VR0_TRIGGER	14	/* trigger */
+/* bit 15 reserved */
+
+/* input: vendor request 0x01 */
+/* bits 0-3 reserved */
+#define HORI_VR1_DPAD3_RIGHT	4	/* d-pad 3 right */
+#define HORI_VR1_DPAD3_MIDDLE	5	/* d-pad 3 middle */
+#define HORI_VR1_DPAD3_LEFT	6	/* d-pad 3 left */
+/* bit 7 reserved */
+#define HORI_VR1_MODE_SELECT	8	/* 2 bits, mode select (M1 - M2 - M3, 2 - 1 - 3) */
+/* bit 10 reserved */
+#define HORI_VR1_BUTTON_SW1	11	/* button sw-1 */
+#define HORI_VR1_DPAD2_TOP	12	/* d-pad 2 top */
+#define HORI_VR1_DPAD2_RIGHT	13	/* d-pad 2 right */
+#define HORI_VR1_DPAD2_BOTTOM	14	/* d-pad 2 bottom */
+#define HORI_VR1_DPAD2_LEFT	15	/* d-pad 2 left */
+
+#define HORI_VR_BITS		16
+
+/*
+ * Button map for the vendor request words, indexed by request and bit.
+ * This is the only place a VR button gets its code; probe registers the
+ * capabilities from it and the decoder looks codes up by bit.
+ */
+static const __u16 hori_vr_keys[HORI_VR_COUNT][HORI_VR_BITS] = {
+	[HORI_POLL_VR0] = {
+		[HORI_VR0_FIRE_C]	= BTN_TRIGGER_HAPPY1,
+		[HORI_VR0_BUTTON_D]	= BTN_TRIGGER_HAPPY2,
+		[HORI_VR0_HAT]		= BTN_TRIGGER_HAPPY3,
+		[HORI_VR0_BUTTON_ST]	= BTN_TRIGGER_HAPPY4,
+		[HORI_VR0_DPAD1_TOP]	= BTN_TRIGGER_HAPPY5,
+		[HORI_VR0_DPAD1_RIGHT]	= BTN_TRIGGER_HAPPY6,
+		[HORI_VR0_DPAD1_BOTTOM]	= BTN_TRIGGER_HAPPY7,
+		[HORI_VR0_DPAD1_LEFT]	= BTN_TRIGGER_HAPPY8,
+		[HORI_VR0_LAUNCH]	= BTN_THUMB,
+		[HORI_VR0_TRIGGER]	= BTN_TRIGGER,
+	},
+	[HORI_POLL_VR1] = {
+		[HORI_VR1_DPAD3_RIGHT]	= BTN_THUMB2,
+		[HORI_VR1_DPAD3_MIDDLE]	= BTN_C,
+		[HORI_VR1_DPAD3_LEFT]	= BTN_X,
+		[HORI_VR1_BUTTON_SW1]	= BTN_Y,
+		/*
+		 * MODE switch, not currently used. Gotta make it
+		 * Press/Unpress or something?
+		 */
+	},
+};
+
+/* A pair of opposite d-pad buttons reported as a 3-position axis */
+struct hori_vr_axis {
+	__u8	vr;
+	__u8	low;	/* pressed: 0 */
+	__u8	high;	/* pressed: 2, neither: 1 */
+	__u16	code;
+};
+
+static const struct hori_vr_axis hori_vr_axes[] = {
+	{ HORI_POLL_VR1, HORI_VR1_DPAD2_LEFT, HORI_VR1_DPAD2_RIGHT, ABS_Z },
+	{ HORI_POLL_VR1, HORI_VR1_DPAD2_TOP, HORI_VR1_DPAD2_BOTTOM, ABS_RZ },
+};
+
+#define HORI_VR_AXES	(sizeof(hori_vr_axes) / sizeof(hori_vr_axes[0]))
+
+/* Decoder state: the last word reported per request */
+struct hori_decoder {
+	__u16	vr_prev[HORI_VR_COUNT];
+	__u16	vr_mask[HORI_VR_COUNT];	/* bits that are mapped */
+	__u8	vr_valid;		/* bit n: vr_prev[n] is valid */
+};
+
+static inline void hori_decoder_init(struct hori_decoder *dec)
+{
+	unsigned int vr, bit, i;
+
+	for (vr = 0; vr < HORI_VR_COUNT; vr++) {
+		dec->vr_mask[vr] = 0;
+		for (bit = 0; bit < HORI_VR_BITS; bit++)
+			if (hori_vr_keys[vr][bit])
+				dec->vr_mask[vr] |= 1u << bit;
+	}
+	for (i = 0; i < HORI_VR_AXES; i++)
+		dec->vr_mask[hori_vr_axes[i].vr] |= 1u << hori_vr_axes[i].low |
+						    1u << hori_vr_axes[i].high;
+	dec->vr_valid = 0;
+}
+
+/* Every field of an interrupt report; returns the number of events */
+static inline unsigned int hori_decode_irq(void *ctx, const __u8 *data)
+{
+	unsigned int i;
+
+	for (i = 0; i < HORI_IRQ_AXES; i++)
+		HORI_EMIT(ctx, EV_ABS, hori_irq_axes[i], data[i]);
+	for (i = HORI_IRQ_AXES; i < HORI_IRQ_REPORT_LEN; i++)
+		HORI_EMIT(ctx, EV_KEY, hori_irq_keys[i - HORI_IRQ_AXES],
+			  data[i] < HORI_IRQ_PRESSED);
+
+	return HORI_IRQ_REPORT_LEN;
+}
+
+/* Mapped bits of @word that differ from the last word reported */
+static inline __u16 hori_vr_changed(const struct hori_decoder *dec,
+				    unsigned int vr, __u16 word)
+{
+	if (!(dec->vr_valid & (1u << vr)))
+		return dec->vr_mask[vr];
+
+	return (word ^ dec->vr_prev[vr]) & dec->vr_mask[vr];
+}
+
+/* Position of a d-pad pair on its axis: 0, 1 (centred) or 2 */
+static inline int hori_vr_axis_value(const struct hori_vr_axis *axis,
+				     __u16 word)
+{
+	if (!(word & (1u << axis->low)))
+		return 0;
+	if (!(word & (1u << axis->high)))
+		return 2;
+	return 1;
+}
+
+/*
+ * Only walks bits that changed since the last reported word, so a poll
+ * that returns the same word costs a compare. Returns the number of
+ * events reported.
+ */
+static inline unsigned int hori_decode_vr(struct hori_decoder *dec, void *ctx,
+					  unsigned int vr, __u16 word)
+{
+	unsigned int bit, i, events = 0;
+	__u16 changed, left;
+
+	changed = hori_vr_changed(dec, vr, word);
+	if (!changed)
+		return 0;
+
+	for (left = changed; left; left &= left - 1) {
+		bit = __builtin_ctz(left);
+		if (!hori_vr_keys[vr][bit])
+			continue;
+		HORI_EMIT(ctx, EV_KEY, hori_vr_keys[vr][bit], !(word & (1u << bit)));
+		events++;
+	}
+
+	for (i = 0; i < HORI_VR_AXES; i++) {
+		const struct hori_vr_axis *axis = &hori_vr_axes[i];
+
+		if (axis->vr != vr ||
+		    !(changed & (1u << axis->low | 1u << axis->high)))
+			continue;
+
+		HORI_EMIT(ctx, EV_ABS, axis->code, hori_vr_axis_value(axis, word));
+		events++;
+	}
+
+	dec->vr_prev[vr] = word;
+	dec->vr_valid |= 1u << vr;
+	return events;
+}
+
+/* Fold an interrupt report into @st */
+static inline void hori_state_irq(struct hori_state *st, const __u8 *data)
+{
+	unsigned int i;
+
+	for (i = 0; i < HORI_IRQ_AXES; i++)
+		st->axes[i] = data[i];
+	for (i = HORI_IRQ_AXES; i < HORI_IRQ_REPORT_LEN; i++)
+		st->pressure[i - HORI_IRQ_AXES] = data[i];
+	st->valid |= 1u << HORI_RAW_IRQ;
+}
+
+/* Fold a vendor request word into @st */
+static inline void hori_state_vr(struct hori_state *st,
+				 const struct hori_decoder *dec,
+				 unsigned int vr, __u16 word)
+{
+	unsigned int i;
+
+	st->buttons[vr] = ~word & dec->vr_mask[vr];
+	for (i = 0; i < HORI_VR_AXES; i++)
+		if (hori_vr_axes[i].vr == vr)
+			st->hats[i] = hori_vr_axis_value(&hori_vr_axes[i], word);
+	if (vr == HORI_POLL_VR1)
+		st->mode = word >> HORI_VR1_MODE_SELECT & 3;
+	st->valid |= 1u << vr;
+}
+
+#endif /* _HORI_REPORT_H */
@@ -0,0 +1,349 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * KUnit tests for the Hori/Namco Flightstick driver
+ *
+ * Included at the end of hori.c when built with CONFIG_HORI_KUNIT_TEST,
+ * so the static helpers can be called directly. The stick under test is
+ * a struct hori with an unregistered input device: decoded events land
+ * in its key and abs state, and nothing is submitted to USB.
+ *
+ * Copyright (C) 2024 Daniel O'Neill <daniel@oneill.app>
+ */
+
+#include <kunit/device.h>
+#include <kunit/test.h>
+
+#define HORI_TEST_BENCH_REPORTS	100000
+
+/* VR words are active low: all released, and with one button pressed */
+#define HORI_TEST_IDLE		0xffff
+#define HORI_TEST_PRESS(bit)	((u16)(HORI_TEST_IDLE & ~BIT(bit)))
+
+static struct hori *hori_test_alloc(struct kunit *test)
+{
+	struct hori *hori;
+
+	hori = kunit_kzalloc(test, sizeof(*hori), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, hori);
+	hori->shm = kunit_kzalloc(test, sizeof(*hori->shm), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, hori->shm);
+
+	hori->dev = kunit_device_register(test, "hori-test");
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, hori->dev);
+
+	spin_lock_init(&hori->frame_lock);
+	seqcount_spinlock_init(&hori->state_seq, &hori->frame_lock);
+	KUNIT_ASSERT_EQ(test, hori_input_init(hori), 0);
+
+	return hori;
+}
+
+/* Events the first report of a vendor request emits: every mapping */
+static unsigned int hori_test_vr_events(unsigned int vr)
+{
+	unsigned int bit, i, events = 0;
+
+	for (bit = 0; bit < HORI_VR_BITS; bit++)
+		events += !!hori_vr_keys[vr][bit];
+	for (i = 0; i < HORI_VR_AXES; i++)
+		events += hori_vr_axes[i].vr == vr;
+
+	return events;
+}
+
+static const struct {
+	int		status;
+	enum hori_next	vr;
+	enum hori_next	irq;
+} hori_test_next[] = {
+	{ 0,		HORI_NEXT_DATA,		HORI_NEXT_DATA },
+	{ -ECONNRESET,	HORI_NEXT_STOP,		HORI_NEXT_STOP },
+	{ -ENOENT,	HORI_NEXT_STOP,		HORI_NEXT_STOP },
+	{ -ESHUTDOWN,	HORI_NEXT_STOP,		HORI_NEXT_STOP },
+	{ -ENODEV,	HORI_NEXT_STOP,		HORI_NEXT_STOP },
+	/* ep0 stalls clear themselves, the interrupt endpoint's don't */
+	{ -EPIPE,	HORI_NEXT_RETRY,	HORI_NEXT_HALT },
+	{ -EPROTO,	HORI_NEXT_RETRY,	HORI_NEXT_RETRY },
+	{ -ETIME,	HORI_NEXT_RETRY,	HORI_NEXT_RETRY },
+	{ -EILSEQ,	HORI_NEXT_RETRY,	HORI_NEXT_RETRY },
+	{ -EOVERFLOW,	HORI_NEXT_RETRY,	HORI_NEXT_RETRY },
+	{ -EREMOTEIO,	HORI_NEXT_RETRY,	HORI_NEXT_RETRY },
+};
+
+static void hori_test_next_status(struct kunit *test)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(hori_test_next); i++) {
+		int status = hori_test_next[i].status;
+
+		KUNIT_EXPECT_EQ_MSG(test, hori_vr_next(status),
+				    hori_test_next[i].vr, "status %d", status);
+		KUNIT_EXPECT_EQ_MSG(test, hori_irq_next(status),
+				    hori_test_next[i].irq, "status %d", status);
+	}
+}
+
+static void hori_test_irq_in_order(struct kunit *test)
+{
+	struct hori *hori = kunit_kzalloc(test, sizeof(*hori), GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_NULL(test, hori);
+
+	KUNIT_EXPECT_TRUE(test, hori_irq_in_order(hori, 0));
+	KUNIT_EXPECT_TRUE(test, hori_irq_in_order(hori, 1));
+	KUNIT_EXPECT_EQ(test, hori->irq_reordered, 0);
+
+	/* 3 overtakes 2: it is used, and 2 is dropped when it turns up */
+	KUNIT_EXPECT_TRUE(test, hori_irq_in_order(hori, 3));
+	KUNIT_EXPECT_FALSE(test, hori_irq_in_order(hori, 2));
+	KUNIT_EXPECT_EQ(test, hori->irq_reordered, 2);
+	KUNIT_EXPECT_TRUE(test, hori_irq_in_order(hori, 4));
+
+	/* The sequence numbers wrap */
+	hori->irq_next_seq = U32_MAX;
+	KUNIT_EXPECT_TRUE(test, hori_irq_in_order(hori, U32_MAX));
+	KUNIT_EXPECT_TRUE(test, hori_irq_in_order(hori, 0));
+	KUNIT_EXPECT_FALSE(test, hori_irq_in_order(hori, U32_MAX));
+}
+
+static void hori_test_vr_changed(struct kunit *test)
+{
+	struct hori_decoder dec;
+	u16 trigger = BIT(HORI_VR0_TRIGGER);
+
+	hori_decoder_init(&dec);
+
+	/* Nothing reported yet: every mapped bit counts as changed */
+	KUNIT_EXPECT_EQ(test, hori_vr_changed(&dec, HORI_POLL_VR0,
+					      HORI_TEST_IDLE),
+			dec.vr_mask[HORI_POLL_VR0]);
+
+	dec.vr_prev[HORI_POLL_VR0] = HORI_TEST_IDLE;
+	dec.vr_valid |= BIT(HORI_POLL_VR0);
+	KUNIT_EXPECT_EQ(test, hori_vr_changed(&dec, HORI_POLL_VR0,
+					      HORI_TEST_IDLE), 0);
+	KUNIT_EXPECT_EQ(test, hori_vr_changed(&dec, HORI_POLL_VR0,
+					      HORI_TEST_PRESS(HORI_VR0_TRIGGER)),
+			trigger);
+
+	/* Reserved bits are not mapped and never count */
+	KUNIT_EXPECT_EQ(test, hori_vr_changed(&dec, HORI_POLL_VR0,
+					      HORI_TEST_PRESS(8)), 0);
+	KUNIT_EXPECT_EQ(test, hori_vr_changed(&dec, HORI_POLL_VR0,
+					      HORI_TEST_PRESS(15)), 0);
+
+	/* VR1 is tracked apart from VR0 */
+	KUNIT_EXPECT_EQ(test, hori_vr_changed(&dec, HORI_POLL_VR1,
+					      HORI_TEST_IDLE),
+			dec.vr_mask[HORI_POLL_VR1]);
+}
+
+static void hori_test_decode_irq(struct kunit *test)
+{
+	struct hori *hori = hori_test_alloc(test);
+	u8 report[HORI_IRQ_REPORT_LEN] = {
+		0x80, 0x7f, 0x00, 0xff, 0x10, 0x20,
+		HORI_IRQ_PRESSED - 1, HORI_IRQ_PRESSED,
+	};
+	unsigned int i;
+
+	KUNIT_EXPECT_EQ(test, hori_decode_irq(hori->input, report),
+			HORI_IRQ_REPORT_LEN);
+
+	for (i = 0; i < HORI_IRQ_AXES; i++)
+		KUNIT_EXPECT_EQ(test, input_abs_get_val(hori->input,
+							hori_irq_axes[i]),
+				report[i]);
+	KUNIT_EXPECT_TRUE(test, test_bit(BTN_A, hori->input->key));
+	KUNIT_EXPECT_FALSE(test, test_bit(BTN_B, hori->input->key));
+}
+
+static void hori_test_decode_vr(struct kunit *test)
+{
+	struct hori *hori = hori_test_alloc(test);
+	struct hori_decoder *dec = &hori->dec;
+	struct input_dev *input = hori->input;
+	u16 word;
+
+	/* The first word reports every mapping, then only what changed */
+	KUNIT_EXPECT_EQ(test, hori_decode_vr(dec, input, HORI_POLL_VR0,
+					     HORI_TEST_IDLE),
+			hori_test_vr_events(HORI_POLL_VR0));
+	KUNIT_EXPECT_EQ(test, hori_decode_vr(dec, input, HORI_POLL_VR0,
+					     HORI_TEST_IDLE), 0);
+
+	word = HORI_TEST_PRESS(HORI_VR0_TRIGGER);
+	KUNIT_EXPECT_EQ(test, hori_decode_vr(dec, input, HORI_POLL_VR0, word), 1);
+	KUNIT_EXPECT_TRUE(test, test_bit(BTN_TRIGGER, input->key));
+	KUNIT_EXPECT_EQ(test, hori_decode_vr(dec, input, HORI_POLL_VR0, word), 0);
+
+	/* A reserved bit changing emits nothing */
+	word &= ~BIT(8);
+	KUNIT_EXPECT_EQ(test, hori_decode_vr(dec, input, HORI_POLL_VR0, word), 0);
+
+	KUNIT_EXPECT_EQ(test, hori_decode_vr(dec, input, HORI_POLL_VR0,
+					     HORI_TEST_IDLE), 1);
+	KUNIT_EXPECT_FALSE(test, test_bit(BTN_TRIGGER, input->key));
+
+	/* D-pad 2 is two 3-position axes in VR1 */
+	KUNIT_EXPECT_EQ(test, hori_decode_vr(dec, input, HORI_POLL_VR1,
+					     HORI_TEST_IDLE),
+			hori_test_vr_events(HORI_POLL_VR1));
+	KUNIT_EXPECT_EQ(test, input_abs_get_val(input, ABS_Z), 1);
+	KUNIT_EXPECT_EQ(test, input_abs_get_val(input, ABS_RZ), 1);
+
+	word = HORI_TEST_PRESS(HORI_VR1_DPAD2_LEFT);
+	KUNIT_EXPECT_EQ(test, hori_decode_vr(dec, input, HORI_POLL_VR1, word), 1);
+	KUNIT_EXPECT_EQ(test, input_abs_get_val(input, ABS_Z), 0);
+
+	word = HORI_TEST_PRESS(HORI_VR1_DPAD2_BOTTOM);
+	KUNIT_EXPECT_EQ(test, hori_decode_vr(dec, input, HORI_POLL_VR1, word), 2);
+	KUNIT_EXPECT_EQ(test, input_abs_get_val(input, ABS_Z), 1);
+	KUNIT_EXPECT_EQ(test, input_abs_get_val(input, ABS_RZ), 2);
+}
+
+static const int hori_test_faults[] = {
+	[HORI_FAULT_EPROTO]	= -EPROTO,
+	[HORI_FAULT_ETIME]	= -ETIME,
+	[HORI_FAULT_EPIPE]	= -EPIPE,
+};
+
+/* Fails the next completion with @kind, through hori_fault() if built in */
+static void hori_test_fault(struct hori *hori, struct urb *urb,
+			    enum hori_fault_kind kind)
+{
+#ifdef CONFIG_FAULT_INJECTION_DEBUG_FS
+	hori->fault = (struct fault_attr)FAULT_ATTR_INITIALIZER;
+	hori->fault.verbose = 0;
+	hori->fault.probability = 100;
+	hori->fault_kinds = BIT(kind);
+#else
+	urb->status = hori_test_faults[kind];
+#endif
+}
+
+static void hori_test_complete(struct hori *hori, struct urb *urb,
+			       unsigned int vr)
+{
+	*urb = (struct urb) {
+		.context	= &hori->ctl[vr],
+		.transfer_buffer = &hori->vr[vr],
+		.actual_length	= sizeof(hori->vr[vr]),
+	};
+}
+
+/*
+ * A VR request failing while a frame waits for it must not hold the frame
+ * back until the retry: what the frame has goes out when the backoff
+ * starts, and the other sources report without waiting for it.
+ */
+static void hori_test_vr_fault(struct kunit *test)
+{
+	struct hori *hori = hori_test_alloc(test);
+	struct hori_ctl *ctl = &hori->ctl[HORI_POLL_VR0];
+	u8 report[HORI_IRQ_REPORT_LEN] = {
+		0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0xff, 0xff,
+	};
+	struct urb *urb;
+	unsigned int kind, vr;
+
+	urb = kunit_kzalloc(test, sizeof(*urb), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, urb);
+	hori->vr = kunit_kzalloc(test, HORI_VR_COUNT * sizeof(*hori->vr),
+				 GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, hori->vr);
+
+	for (vr = 0; vr < HORI_VR_COUNT; vr++) {
+		hori->ctl[vr].hori = hori;
+		hori->ctl[vr].vr = vr;
+		INIT_DELAYED_WORK(&hori->ctl[vr].retry, hori_vr_retry_work);
+		hori->vr[vr] = cpu_to_le16(HORI_TEST_IDLE);
+	}
+	/* Paced, so the completions leave resubmitting to the poll timer */
+	hori->poll_rate = 500;
+	hori->polling = true;
+
+	for (kind = 0; kind < ARRAY_SIZE(hori_test_faults); kind++) {
+		/* A long backoff, so the retry can't submit the fake URB */
+		ctl->retries = 10;
+		hori->flags = HORI_VR_MASK;
+
+		report[0] = 0x40 + kind;
+		hori_frame_commit(hori, HORI_FRAME_IRQ, report, ktime_get());
+		KUNIT_EXPECT_EQ(test, hori->frame.dirty, BIT(HORI_FRAME_IRQ));
+
+		hori_test_complete(hori, urb, HORI_POLL_VR0);
+		hori_test_fault(hori, urb, kind);
+		hori_poll_vr_complete(urb);
+		KUNIT_EXPECT_EQ(test, urb->status, hori_test_faults[kind]);
+
+		KUNIT_EXPECT_TRUE(test, test_bit(HORI_POLL_VR0, &hori->vr_backoff));
+		KUNIT_EXPECT_EQ(test, hori->frame.dirty, 0);
+		KUNIT_EXPECT_EQ(test, input_abs_get_val(hori->input, ABS_X),
+				report[0]);
+
+		/* VR1 goes out on its own while VR0 waits to retry */
+		hori_test_complete(hori, urb, HORI_POLL_VR1);
+		hori_poll_vr_complete(urb);
+		KUNIT_EXPECT_EQ(test, hori->frame.dirty, 0);
+		KUNIT_EXPECT_FALSE(test, test_bit(HORI_POLL_VR1, &hori->flags));
+
+		KUNIT_EXPECT_TRUE(test, cancel_delayed_work_sync(&ctl->retry));
+		clear_bit(HORI_POLL_VR0, &hori->vr_backoff);
+	}
+
+	KUNIT_EXPECT_EQ(test, atomic_long_read(&hori->stats[HORI_STAT_RETRIES]),
+			ARRAY_SIZE(hori_test_faults));
+}
+
+/* Reports @a and @b in turn; returns the ns per report */
+static u64 hori_test_bench(struct hori *hori, u16 a, u16 b,
+			   unsigned int *events)
+{
+	ktime_t start;
+	unsigned int i;
+
+	*events = 0;
+	start = ktime_get();
+	for (i = 0; i < HORI_TEST_BENCH_REPORTS; i++)
+		*events += hori_report_vr(hori, HORI_POLL_VR0, i & 1 ? b : a);
+
+	return div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)),
+		       HORI_TEST_BENCH_REPORTS);
+}
+
+static void hori_test_decode_bench(struct kunit *test)
+{
+	struct hori *hori = hori_test_alloc(test);
+	unsigned int events;
+	u64 ns;
+
+	hori_report_vr(hori, HORI_POLL_VR0, HORI_TEST_IDLE);
+
+	ns = hori_test_bench(hori, HORI_TEST_IDLE, HORI_TEST_IDLE, &events);
+	KUNIT_EXPECT_EQ(test, events, 0);
+	kunit_info(test, "unchanged: %llu ns/report\n", ns);
+
+	ns = hori_test_bench(hori, HORI_TEST_PRESS(HORI_VR0_TRIGGER),
+			     HORI_TEST_IDLE, &events);
+	KUNIT_EXPECT_EQ(test, events, HORI_TEST_BENCH_REPORTS);
+	kunit_info(test, "changed: %llu ns/report\n", ns);
+}
+
+static struct kunit_case hori_test_cases[] = {
+	KUNIT_CASE(hori_test_next_status),
+	KUNIT_CASE(hori_test_irq_in_order),
+	KUNIT_CASE(hori_test_vr_changed),
+	KUNIT_CASE(hori_test_decode_irq),
+	KUNIT_CASE(hori_test_decode_vr),
+	KUNIT_CASE(hori_test_vr_fault),
+	KUNIT_CASE_SLOW(hori_test_decode_bench),
+	{}
+};
+
+static struct kunit_suite hori_test_suite = {
+	.name = "hori",
+	.test_cases = hori_test_cases,
+};
+kunit_test_suite(hori_test_suite);
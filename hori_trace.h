@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Tracepoints for the Hori/Namco Flightstick driver
+ *
+ * Copyright (C) 2024 Daniel O'Neill <daniel@oneill.app>
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM hori
+
+#if !defined(_HORI_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _HORI_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/usb.h>
+
+#include <asm/unaligned.h>
+
+TRACE_EVENT(hori_vr_submit,
+	TP_PROTO(const struct device *dev, u8 vr, int error),
+	TP_ARGS(dev, vr, error),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u8, vr)
+		__field(int, error)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev);
+		__entry->vr = vr;
+		__entry->error = error;
+	),
+
+	TP_printk("%s vr%u error=%d", __get_str(dev), __entry->vr,
+		  __entry->error)
+);
+
+TRACE_EVENT(hori_vr_complete,
+	TP_PROTO(const struct device *dev, u8 vr, const struct urb *urb),
+	TP_ARGS(dev, vr, urb),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u8, vr)
+		__field(int, status)
+		__field(u32, len)
+		__field(u16, word)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev);
+		__entry->vr = vr;
+		__entry->status = urb->status;
+		__entry->len = urb->actual_length;
+		__entry->word = urb->actual_length >= 2 ?
+			get_unaligned_le16(urb->transfer_buffer) : 0;
+	),
+
+	TP_printk("%s vr%u status=%d len=%u word=%04x", __get_str(dev),
+		  __entry->vr, __entry->status, __entry->len, __entry->word)
+);
+
+TRACE_EVENT(hori_irq,
+	TP_PROTO(const struct device *dev, u32 seq, const struct urb *urb),
+	TP_ARGS(dev, seq, urb),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(u32, seq)
+		__field(int, status)
+		__field(u32, len)
+		__array(u8, data, 8)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev);
+		__entry->seq = seq;
+		__entry->status = urb->status;
+		__entry->len = urb->actual_length;
+		memset(__entry->data, 0, sizeof(__entry->data));
+		memcpy(__entry->data, urb->transfer_buffer,
+		       min_t(u32, urb->actual_length, sizeof(__entry->data)));
+	),
+
+	TP_printk("%s seq=%u status=%d len=%u data=%*phN", __get_str(dev),
+		  __entry->seq, __entry->status, __entry->len,
+		  (int)sizeof(__entry->data), __entry->data)
+);
+
+/* sources: bit 0 VR0, bit 1 VR1, bit 2 interrupt report */
+TRACE_EVENT(hori_sync,
+	TP_PROTO(const struct device *dev, unsigned long sources,
+		 unsigned int events),
+	TP_ARGS(dev, sources, events),
+
+	TP_STRUCT__entry(
+		__string(dev, dev_name(dev))
+		__field(unsigned long, sources)
+		__field(unsigned int, events)
+	),
+
+	TP_fast_assign(
+		__assign_str(dev);
+		__entry->sources = sources;
+		__entry->events = events;
+	),
+
+	TP_printk("%s sources=%s%s%s events=%u", __get_str(dev),
+		  __entry->sources & BIT(0) ? "vr0," : "",
+		  __entry->sources & BIT(1) ? "vr1," : "",
+		  __entry->sources & BIT(2) ? "irq" : "",
+		  __entry->events)
+);
+
+#endif /* _HORI_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE hori_trace
+#include <trace/define_trace.h>
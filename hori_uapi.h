@@ -0,0 +1,319 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Userspace interface of the Hori/Namco Flightstick driver
+ *
+ * Copyright (C) 2024 Daniel O'Neill <daniel@oneill.app>
+ */
+
+#ifndef _HORI_UAPI_H
+#define _HORI_UAPI_H
+
+#include <linux/types.h>
+
+/* Raw transfer types, also the source numbers used by the driver */
+#define HORI_RAW_VR0		0	/* vendor request 0x00, 2 bytes */
+#define HORI_RAW_VR1		1	/* vendor request 0x01, 2 bytes */
+#define HORI_RAW_IRQ		2	/* interrupt report, 8 bytes */
+
+/*
+ * One record read from /sys/kernel/debug/hori/<interface>/raw. seq counts
+ * every record the driver captured, so a gap means the reader fell
+ * behind and records were overwritten.
+ */
+struct hori_raw_record {
+	__u64	time_ns;	/* CLOCK_MONOTONIC at completion */
+	__u32	seq;
+	__u8	type;		/* HORI_RAW_* */
+	__u8	len;		/* valid bytes in data */
+	__u16	reserved;
+	__u8	data[8];
+};
+
+/*
+ * Decoded state of the whole stick, as last delivered to the input
+ * device. Buttons are 1 when pressed; buttons[n] holds the mapped bits of
+ * vendor request n, including the d-pad pairs that also make up hats[].
+ */
+#define HORI_STATE_AXES		6
+#define HORI_STATE_HATS		2
+
+struct hori_state {
+	__u8	axes[HORI_STATE_AXES];	/* X, Y, rudder, RX, RY, throttle */
+	__u8	pressure[2];	/* A and B, lower is harder */
+	__u16	buttons[2];	/* indexed by HORI_RAW_VR0/VR1 */
+	__u8	hats[HORI_STATE_HATS];	/* d-pad 2 as ABS_Z, ABS_RZ: 0-2 */
+	__u8	mode;		/* mode select switch, 0-3 */
+	__u8	valid;		/* bit n: HORI_RAW_* source n seen */
+};
+
+/*
+ * Read-only page mapped from /dev/hori<N>: the state above plus when each
+ * part of it last changed. seq is odd while the driver updates the page,
+ * so a reader copies it between two equal, even values of seq; see
+ * hori_shm_read().
+ */
+#define HORI_SHM_AXES		0
+#define HORI_SHM_PRESSURE	1
+#define HORI_SHM_BUTTONS_VR0	2
+#define HORI_SHM_BUTTONS_VR1	3
+#define HORI_SHM_HATS		4
+#define HORI_SHM_MODE		5
+#define HORI_SHM_FIELDS		6
+
+struct hori_shm {
+	__u32			seq;
+	__u32			reserved;
+	struct hori_state	state;
+	__u64			changed_ns[HORI_SHM_FIELDS];	/* CLOCK_MONOTONIC */
+};
+
+/*
+ * One frame read from /dev/hori-raw<N>: the interrupt report and both
+ * vendor request words each time the driver completes a frame (see
+ * frame_mode), including frames that change no input event. seq counts
+ * frames; a gap means this reader fell behind and lost frames. A read
+ * returns as many whole frames as fit.
+ */
+struct hori_frame_record {
+	__u64	time_ns;	/* CLOCK_MONOTONIC of the newest transfer */
+	__u32	seq;
+	__u16	vr[2];		/* VR0/VR1 words, host order */
+	__u8	report[8];	/* interrupt report */
+	__u8	dirty;		/* bit n: HORI_RAW_* source n is new */
+	__u8	reserved[7];
+};
+
+#ifndef __KERNEL__
+/* A consistent copy of the mapped page @shm; never blocks the driver */
+static inline void hori_shm_read(const struct hori_shm *shm,
+				 struct hori_shm *out)
+{
+	__u32 seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		__builtin_memcpy(out, (const void *)shm, sizeof(*out));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+			break;
+	}
+	out->seq = seq;
+}
+#endif
+
+/*
+ * Capture files, read from .../capture and written to .../replay of the
+ * virtual stick. They start with the 8 byte magic, followed by records:
+ *
+ *	tag	transfer type in bits 0-1, flags above
+ *	delta	time since the previous record in ns, zigzag LEB128
+ *	len	HORI_CAPTURE_LEN only: payload length, payload sent whole
+ *	mask	interrupt reports only: bit n set if byte n follows
+ *	payload	the bytes in mask
+ *
+ * Payloads are deltas against the previous record of the same type; a VR
+ * word keeps its 2-bit mask in the tag instead. A stick at rest costs 3-5
+ * bytes per interrupt report instead of a 24 byte hori_raw_record. A
+ * HORI_CAPTURE_GAP tag is followed by the number of records lost (LEB128)
+ * and nothing else.
+ */
+#define HORI_CAPTURE_MAGIC	"HORICAP1"
+#define HORI_CAPTURE_MAGIC_LEN	8
+
+#define HORI_CAPTURE_GAP	3
+#define HORI_CAPTURE_TYPE	0x03
+#define HORI_CAPTURE_VR_SHIFT	2
+#define HORI_CAPTURE_LEN	0x80	/* length differs from the usual one */
+
+/* Longest encoding of one record, including a gap in front of it */
+#define HORI_CAPTURE_MAX_RECORD	32
+
+/* Codec state; both sides start from all zeroes */
+struct hori_capture_state {
+	__u64	time_ns;
+	__u32	seq;
+	__u8	prev[3][8];	/* last payload per HORI_RAW_* type */
+};
+
+static inline unsigned int hori_capture_put_varint(__u8 *out, __u64 v)
+{
+	unsigned int n = 0;
+
+	while (v >= 0x80) {
+		out[n++] = (__u8)v | 0x80;
+		v >>= 7;
+	}
+	out[n++] = (__u8)v;
+
+	return n;
+}
+
+/* Returns the bytes used, 0 if more are needed, -1 if malformed */
+static inline int hori_capture_get_varint(const __u8 *in, unsigned int avail,
+					  __u64 *v)
+{
+	__u64 x = 0;
+	unsigned int n;
+
+	for (n = 0; n < avail && n < 10; n++) {
+		x |= (__u64)(in[n] & 0x7f) << (7 * n);
+		if (!(in[n] & 0x80)) {
+			*v = x;
+			return n + 1;
+		}
+	}
+
+	return n == 10 ? -1 : 0;
+}
+
+static inline unsigned int hori_capture_full_len(unsigned int type)
+{
+	return type == HORI_RAW_IRQ ? 8 : 2;
+}
+
+/*
+ * Encodes @rec into @out, which must hold HORI_CAPTURE_MAX_RECORD bytes.
+ * Returns the number of bytes written.
+ */
+static inline unsigned int
+hori_capture_encode(struct hori_capture_state *st,
+		    const struct hori_raw_record *rec, __u8 *out)
+{
+	unsigned int type = rec->type & HORI_CAPTURE_TYPE;
+	unsigned int len = rec->len > 8 ? 8 : rec->len;
+	__s64 delta = (__s64)(rec->time_ns - st->time_ns);
+	__u8 *prev = st->prev[type];
+	unsigned int n = 0, i;
+	__u8 tag = type, mask = 0;
+
+	if (rec->seq != st->seq) {
+		out[n++] = HORI_CAPTURE_GAP;
+		n += hori_capture_put_varint(out + n, (__u32)(rec->seq - st->seq));
+	}
+
+	if (len != hori_capture_full_len(type)) {
+		tag |= HORI_CAPTURE_LEN;
+		mask = (1u << len) - 1;
+	} else {
+		for (i = 0; i < len; i++)
+			if (rec->data[i] != prev[i])
+				mask |= 1u << i;
+		if (type != HORI_RAW_IRQ)
+			tag |= mask << HORI_CAPTURE_VR_SHIFT;
+	}
+
+	out[n++] = tag;
+	n += hori_capture_put_varint(out + n,
+				     ((__u64)delta << 1) ^ (__u64)(delta >> 63));
+	if (tag & HORI_CAPTURE_LEN)
+		out[n++] = len;
+	else if (type == HORI_RAW_IRQ)
+		out[n++] = mask;
+
+	for (i = 0; i < 8; i++) {
+		if (mask & (1u << i))
+			out[n++] = rec->data[i];
+		if (tag & HORI_CAPTURE_LEN)
+			prev[i] = i < len ? rec->data[i] : 0;
+		else if (i < len)
+			prev[i] = rec->data[i];
+	}
+
+	st->time_ns = rec->time_ns;
+	st->seq = rec->seq + 1;
+
+	return n;
+}
+
+/*
+ * Decodes one record from @in. A gap comes back as a record of type
+ * HORI_CAPTURE_GAP with no payload, its seq already past the lost ones.
+ * Returns the bytes used, 0 if more are needed (@st is left alone then),
+ * or -1 if the stream is malformed.
+ */
+static inline int hori_capture_decode(struct hori_capture_state *st,
+				      const __u8 *in, unsigned int avail,
+				      struct hori_raw_record *rec)
+{
+	unsigned int type, len, i, bytes = 0, n = 1;
+	__u8 tag, mask;
+	__u64 v;
+	int used;
+
+	if (!avail)
+		return 0;
+
+	tag = in[0];
+	type = tag & HORI_CAPTURE_TYPE;
+	used = hori_capture_get_varint(in + n, avail - n, &v);
+	if (used <= 0)
+		return used;
+	n += used;
+
+	if (type == HORI_CAPTURE_GAP) {
+		if (tag != HORI_CAPTURE_GAP || v > 0xffffffffu)
+			return -1;
+		st->seq += (__u32)v;
+		rec->time_ns = st->time_ns;
+		rec->seq = st->seq;
+		rec->type = HORI_CAPTURE_GAP;
+		rec->len = 0;
+		rec->reserved = 0;
+		for (i = 0; i < 8; i++)
+			rec->data[i] = 0;
+		return n;
+	}
+
+	if (tag & HORI_CAPTURE_LEN) {
+		if (tag & ~(HORI_CAPTURE_TYPE | HORI_CAPTURE_LEN))
+			return -1;
+		if (n == avail)
+			return 0;
+		len = in[n++];
+		if (len > 8)
+			return -1;
+		mask = (1u << len) - 1;
+	} else if (type == HORI_RAW_IRQ) {
+		if (tag & ~HORI_CAPTURE_TYPE)
+			return -1;
+		if (n == avail)
+			return 0;
+		len = 8;
+		mask = in[n++];
+	} else {
+		if (tag & ~(HORI_CAPTURE_TYPE | 3u << HORI_CAPTURE_VR_SHIFT))
+			return -1;
+		len = 2;
+		mask = tag >> HORI_CAPTURE_VR_SHIFT;
+	}
+
+	for (i = 0; i < 8; i++)
+		bytes += (mask >> i) & 1;
+	if (avail - n < bytes)
+		return 0;
+
+	rec->time_ns = st->time_ns + (__u64)((v >> 1) ^ -(v & 1));
+	rec->seq = st->seq;
+	rec->type = type;
+	rec->len = len;
+	rec->reserved = 0;
+	for (i = 0; i < 8; i++) {
+		if (mask & (1u << i))
+			rec->data[i] = in[n++];
+		else if (!(tag & HORI_CAPTURE_LEN) && i < len)
+			rec->data[i] = st->prev[type][i];
+		else
+			rec->data[i] = 0;
+		if ((tag & HORI_CAPTURE_LEN) || i < len)
+			st->prev[type][i] = rec->data[i];
+	}
+
+	st->time_ns = rec->time_ns;
+	st->seq++;
+
+	return n;
+}
+
+#endif /* _HORI_UAPI_H */
@@ -0,0 +1,442 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Report rate, jitter and latency of a Hori/Namco Flightstick evdev node
+ *
+ * Reads the stick's events for a while and groups them by the transfer
+ * that carries them: the interrupt report (axes, A/B), VR0 or VR1. For
+ * each group and each event code it prints how often it updated and the
+ * spread of the gaps in between; for every SYN_REPORT, how long it took
+ * from the kernel timestamp until read() returned it. The driver only
+ * reports changes, so keep the stick moving (or use hori-gadget) to
+ * measure the full rate.
+ *
+ *	hori-bench -t 30 /dev/input/event7
+ *	hori-bench -j > run.json		first stick found, JSON out
+ *
+ * Copyright (C) 2024 Daniel O'Neill <daniel@oneill.app>
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/input.h>
+
+#define HORI_EMIT(ctx, type, code, value) do { } while (0)
+#include "../hori_report.h"
+
+#define HORI_NAME	"Mitsubishi Hori/Namco Flightstick"
+
+enum group {
+	GROUP_IRQ,
+	GROUP_VR0,
+	GROUP_VR1,
+	GROUPS
+};
+
+static const char *const group_names[GROUPS] = { "irq", "vr0", "vr1" };
+
+struct series {
+	uint64_t	*v;
+	size_t		n, size;
+};
+
+struct stats {
+	const char	*name;
+	uint64_t	count;
+	uint64_t	last;		/* ns, 0 = none yet */
+	struct series	gaps;
+};
+
+struct code {
+	unsigned int	type, code;
+	enum group	group;
+	struct stats	st;
+};
+
+static struct code codes[64];
+static unsigned int ncodes;
+static struct stats groups[GROUPS];
+static struct series latency;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void push(struct series *s, uint64_t v)
+{
+	if (s->n == s->size) {
+		s->size = s->size ? s->size * 2 : 1024;
+		s->v = realloc(s->v, s->size * sizeof(*s->v));
+		if (!s->v) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	s->v[s->n++] = v;
+}
+
+static void update(struct stats *st, uint64_t t)
+{
+	if (st->last && t > st->last)
+		push(&st->gaps, t - st->last);
+	st->last = t;
+	st->count++;
+}
+
+static const char *code_name(unsigned int type, unsigned int code)
+{
+	static char buf[32];
+
+#define NAME(c) case c: return #c
+	if (type == EV_ABS) {
+		switch (code) {
+		NAME(ABS_X); NAME(ABS_Y); NAME(ABS_Z); NAME(ABS_RX);
+		NAME(ABS_RY); NAME(ABS_RZ); NAME(ABS_THROTTLE); NAME(ABS_RUDDER);
+		}
+	} else {
+		switch (code) {
+		NAME(BTN_A); NAME(BTN_B); NAME(BTN_C); NAME(BTN_X); NAME(BTN_Y);
+		NAME(BTN_TRIGGER); NAME(BTN_THUMB); NAME(BTN_THUMB2);
+		}
+		if (code >= BTN_TRIGGER_HAPPY1 && code <= BTN_TRIGGER_HAPPY40) {
+			snprintf(buf, sizeof(buf), "BTN_TRIGGER_HAPPY%u",
+				 code - BTN_TRIGGER_HAPPY1 + 1);
+			return buf;
+		}
+	}
+#undef NAME
+
+	snprintf(buf, sizeof(buf), "%s_%#x", type == EV_ABS ? "ABS" : "KEY", code);
+	return buf;
+}
+
+static void add_code(unsigned int type, unsigned int code, enum group group)
+{
+	struct code *c = &codes[ncodes++];
+
+	c->type = type;
+	c->code = code;
+	c->group = group;
+	c->st.name = strdup(code_name(type, code));
+}
+
+/* Which transfer carries which code, straight from the driver's tables */
+static void init_codes(void)
+{
+	unsigned int i, vr, bit;
+
+	for (i = 0; i < HORI_IRQ_AXES; i++)
+		add_code(EV_ABS, hori_irq_axes[i], GROUP_IRQ);
+	for (i = 0; i < HORI_IRQ_REPORT_LEN - HORI_IRQ_AXES; i++)
+		add_code(EV_KEY, hori_irq_keys[i], GROUP_IRQ);
+	for (vr = 0; vr < HORI_VR_COUNT; vr++)
+		for (bit = 0; bit < HORI_VR_BITS; bit++)
+			if (hori_vr_keys[vr][bit])
+				add_code(EV_KEY, hori_vr_keys[vr][bit],
+					 GROUP_VR0 + vr);
+	for (i = 0; i < HORI_VR_AXES; i++)
+		add_code(EV_ABS, hori_vr_axes[i].code,
+			 GROUP_VR0 + hori_vr_axes[i].vr);
+
+	for (i = 0; i < GROUPS; i++)
+		groups[i].name = group_names[i];
+}
+
+static struct code *find_code(unsigned int type, unsigned int code)
+{
+	unsigned int i;
+
+	for (i = 0; i < ncodes; i++)
+		if (codes[i].type == type && codes[i].code == code)
+			return &codes[i];
+
+	return NULL;
+}
+
+/* First event node whose name is the stick's */
+static char *find_stick(void)
+{
+	static char path[300];
+	char name[256];
+	struct dirent *de;
+	DIR *dir;
+	int fd;
+
+	dir = opendir("/dev/input");
+	if (!dir)
+		return NULL;
+
+	while ((de = readdir(dir))) {
+		if (strncmp(de->d_name, "event", 5))
+			continue;
+		snprintf(path, sizeof(path), "/dev/input/%s", de->d_name);
+		fd = open(path, O_RDONLY);
+		if (fd < 0)
+			continue;
+		if (ioctl(fd, EVIOCGNAME(sizeof(name)), name) > 0 &&
+		    !strcmp(name, HORI_NAME)) {
+			close(fd);
+			closedir(dir);
+			return path;
+		}
+		close(fd);
+	}
+
+	closedir(dir);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static const double pct[] = { 50, 90, 99, 99.9 };
+#define PCTS	(sizeof(pct) / sizeof(pct[0]))
+
+struct summary {
+	double	p[PCTS];
+	double	max;
+	double	mean;
+	double	stddev;		/* jitter */
+};
+
+/* In microseconds */
+static int summarize(struct series *s, struct summary *sum)
+{
+	double total = 0, var = 0;
+	unsigned int i;
+
+	if (!s->n)
+		return -1;
+
+	qsort(s->v, s->n, sizeof(*s->v), cmp_u64);
+	for (i = 0; i < PCTS; i++)
+		sum->p[i] = s->v[(size_t)(s->n * pct[i] / 100)] / 1000.0;
+	sum->max = s->v[s->n - 1] / 1000.0;
+
+	for (i = 0; i < s->n; i++)
+		total += s->v[i];
+	sum->mean = total / s->n / 1000.0;
+	for (i = 0; i < s->n; i++) {
+		double d = s->v[i] / 1000.0 - sum->mean;
+
+		var += d * d;
+	}
+	sum->stddev = sqrt(var / s->n);
+
+	return 0;
+}
+
+static void print_text_row(const struct stats *st, const char *group,
+			   double seconds)
+{
+	struct summary sum;
+	unsigned int i;
+
+	printf("%-20s %-4s %8llu %9.1f", st->name, group,
+	       (unsigned long long)st->count, st->count / seconds);
+	if (summarize((struct series *)&st->gaps, &sum)) {
+		printf("\n");
+		return;
+	}
+	for (i = 0; i < PCTS; i++)
+		printf(" %9.0f", sum.p[i]);
+	printf(" %9.0f %9.1f\n", sum.max, sum.stddev);
+}
+
+static void print_text(double seconds)
+{
+	struct summary sum;
+	unsigned int i;
+
+	printf("%.1f s, gaps and jitter in us\n\n", seconds);
+	printf("%-20s %-4s %8s %9s %9s %9s %9s %9s %9s %9s\n", "", "", "updates",
+	       "rate/s", "p50", "p90", "p99", "p99.9", "max", "jitter");
+	for (i = 0; i < GROUPS; i++)
+		print_text_row(&groups[i], "", seconds);
+	printf("\n");
+	for (i = 0; i < ncodes; i++)
+		if (codes[i].st.count)
+			print_text_row(&codes[i].st, group_names[codes[i].group],
+				       seconds);
+
+	printf("\nlatency, kernel timestamp to read(), us:");
+	if (summarize(&latency, &sum)) {
+		printf(" no samples\n");
+		return;
+	}
+	for (i = 0; i < PCTS; i++)
+		printf(" p%g=%.1f", pct[i], sum.p[i]);
+	printf(" max=%.1f\n", sum.max);
+}
+
+static void print_json_summary(struct series *s)
+{
+	struct summary sum;
+	unsigned int i;
+
+	if (summarize(s, &sum)) {
+		printf("null");
+		return;
+	}
+	printf("{");
+	for (i = 0; i < PCTS; i++)
+		printf("\"p%g\": %.1f, ", pct[i], sum.p[i]);
+	printf("\"max\": %.1f, \"mean\": %.1f, \"stddev\": %.1f}",
+	       sum.max, sum.mean, sum.stddev);
+}
+
+static void print_json_stats(struct stats *st, const char *group, double seconds)
+{
+	printf("{\"name\": \"%s\", ", st->name);
+	if (group)
+		printf("\"group\": \"%s\", ", group);
+	printf("\"updates\": %llu, \"rate\": %.1f, \"gap_us\": ",
+	       (unsigned long long)st->count, st->count / seconds);
+	print_json_summary(&st->gaps);
+	printf("}");
+}
+
+static void print_json(double seconds)
+{
+	unsigned int i;
+	const char *sep = "";
+
+	printf("{\"seconds\": %.3f,\n \"groups\": [", seconds);
+	for (i = 0; i < GROUPS; i++) {
+		printf("%s\n  ", i ? "," : "");
+		print_json_stats(&groups[i], NULL, seconds);
+	}
+	printf("],\n \"codes\": [");
+	for (i = 0; i < ncodes; i++) {
+		if (!codes[i].st.count)
+			continue;
+		printf("%s\n  ", sep);
+		print_json_stats(&codes[i].st, group_names[codes[i].group], seconds);
+		sep = ",";
+	}
+	printf("],\n \"latency_us\": ");
+	print_json_summary(&latency);
+	printf("\n}\n");
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t SECONDS] [-j] [EVDEV]\n"
+		"  -t SECONDS  how long to measure (default 10)\n"
+		"  -j          JSON output\n"
+		"  EVDEV       event node, default: the first stick found\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int duration = 10, touched = 0, i;
+	struct input_event ev[64];
+	int clock = CLOCK_MONOTONIC, json = 0, fd, opt, n;
+	uint64_t start, end, t, now;
+	struct pollfd pfd;
+	struct code *c;
+	char *path;
+
+	while ((opt = getopt(argc, argv, "t:j")) != -1) {
+		switch (opt) {
+		case 't': duration = atoi(optarg); break;
+		case 'j': json = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (!duration || argc - optind > 1)
+		usage(argv[0]);
+
+	path = optind < argc ? argv[optind] : find_stick();
+	if (!path) {
+		fprintf(stderr, "no %s found\n", HORI_NAME);
+		return 1;
+	}
+
+	fd = open(path, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	if (ioctl(fd, EVIOCSCLOCKID, &clock) < 0) {
+		perror("EVIOCSCLOCKID");
+		return 1;
+	}
+
+	init_codes();
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	start = now_ns();
+	end = start + duration * 1000000000ULL;
+
+	while ((now = now_ns()) < end) {
+		if (poll(&pfd, 1, (end - now) / 1000000 + 1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return 1;
+		}
+
+		n = read(fd, ev, sizeof(ev));
+		now = now_ns();
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			perror("read");
+			return 1;
+		}
+
+		for (i = 0; i < n / sizeof(ev[0]); i++) {
+			t = ev[i].input_event_sec * 1000000000ULL +
+			    ev[i].input_event_usec * 1000ULL;
+
+			if (ev[i].type == EV_SYN) {
+				if (ev[i].code != SYN_REPORT)
+					continue;
+				for (int g = 0; g < GROUPS; g++)
+					if (touched & (1u << g))
+						update(&groups[g], t);
+				touched = 0;
+				if (now > t)
+					push(&latency, now - t);
+				continue;
+			}
+
+			c = find_code(ev[i].type, ev[i].code);
+			if (!c)
+				continue;
+			update(&c->st, t);
+			touched |= 1u << c->group;
+		}
+	}
+
+	if (json)
+		print_json((now - start) / 1e9);
+	else
+		print_text((now - start) / 1e9);
+
+	return 0;
+}
@@ -0,0 +1,311 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Userspace benchmark of the Hori/Namco Flightstick decoder
+ *
+ * Runs the decoder from hori_report.h over a capture file or a synthetic
+ * stream the way hori.c does: repeated interrupt reports are filtered,
+ * VR words go through the changed-bit walk. Hardware counters around the
+ * loop come from perf_event_open, so this runs under perf, valgrind or
+ * a debugger like any other program.
+ *
+ *	hori-decode-bench -p 5			5% of the transfers change
+ *	hori-decode-bench -c flight.hcap	a capture from debugfs
+ *
+ * Copyright (C) 2024 Daniel O'Neill <daniel@oneill.app>
+ */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/perf_event.h>
+
+#include "../hori_uapi.h"
+
+/* Stands in for input_event(); keeps the compiler from dropping events */
+struct sink {
+	uint64_t	events;
+	uint64_t	hash;
+};
+
+#define HORI_EMIT(ctx, type, code, value)				\
+do {									\
+	struct sink *__s = (ctx);					\
+									\
+	__s->events++;							\
+	__s->hash = __s->hash * 31 + ((type) << 24 ^ (code) << 8 ^ (value)); \
+} while (0)
+
+#include "../hori_report.h"
+
+struct transfer {
+	uint8_t		type;		/* HORI_RAW_* */
+	uint8_t		data[HORI_IRQ_REPORT_LEN];
+};
+
+static const struct {
+	const char	*name;
+	uint32_t	config;
+} counters[] = {
+	{ "cycles",		PERF_COUNT_HW_CPU_CYCLES },
+	{ "instructions",	PERF_COUNT_HW_INSTRUCTIONS },
+	{ "branches",		PERF_COUNT_HW_BRANCH_INSTRUCTIONS },
+	{ "branch-misses",	PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+#define COUNTERS	(sizeof(counters) / sizeof(counters[0]))
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * One poll cycle per interrupt report, as with the default poll_rate and
+ * interval; each transfer changes with probability @pct percent.
+ */
+static struct transfer *synthetic(unsigned int cycles, unsigned int pct,
+				  unsigned int *count)
+{
+	uint8_t report[HORI_IRQ_REPORT_LEN] = {
+		0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0xff, 0xff,
+	};
+	uint16_t vr[HORI_VR_COUNT] = { 0xffff, 0xffff };
+	struct hori_decoder dec;
+	struct transfer *t;
+	unsigned int i, n = 0, bit;
+
+	hori_decoder_init(&dec);
+	t = calloc(cycles * 3, sizeof(*t));
+	if (!t)
+		return NULL;
+
+	for (i = 0; i < cycles; i++) {
+		if ((unsigned int)rand() % 100 < pct)
+			report[rand() % HORI_IRQ_REPORT_LEN] = rand();
+		t[n].type = HORI_RAW_IRQ;
+		memcpy(t[n++].data, report, sizeof(report));
+
+		for (unsigned int v = 0; v < HORI_VR_COUNT; v++) {
+			if ((unsigned int)rand() % 100 < pct) {
+				do
+					bit = rand() % HORI_VR_BITS;
+				while (!(dec.vr_mask[v] & (1u << bit)));
+				vr[v] ^= 1u << bit;
+			}
+			t[n].type = v;
+			t[n].data[0] = vr[v];
+			t[n++].data[1] = vr[v] >> 8;
+		}
+	}
+
+	*count = n;
+	return t;
+}
+
+static struct transfer *load_capture(const char *path, unsigned int *count)
+{
+	struct hori_capture_state cap = { 0 };
+	struct hori_raw_record rec;
+	struct transfer *t = NULL;
+	unsigned int n = 0, size = 0, off;
+	uint8_t *buf;
+	long len;
+	FILE *f;
+	int used;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	rewind(f);
+	buf = malloc(len);
+	if (!buf || fread(buf, 1, len, f) != (size_t)len ||
+	    len < HORI_CAPTURE_MAGIC_LEN ||
+	    memcmp(buf, HORI_CAPTURE_MAGIC, HORI_CAPTURE_MAGIC_LEN)) {
+		fprintf(stderr, "%s: not a capture file\n", path);
+		exit(1);
+	}
+	fclose(f);
+
+	for (off = HORI_CAPTURE_MAGIC_LEN; off < len; off += used) {
+		used = hori_capture_decode(&cap, buf + off, len - off, &rec);
+		if (used <= 0) {
+			fprintf(stderr, "%s: corrupt at byte %u\n", path, off);
+			exit(1);
+		}
+		if (rec.type == HORI_CAPTURE_GAP ||
+		    rec.len != (rec.type == HORI_RAW_IRQ ? HORI_IRQ_REPORT_LEN : 2))
+			continue;
+
+		if (n == size) {
+			size = size ? size * 2 : 4096;
+			t = realloc(t, size * sizeof(*t));
+			if (!t)
+				return NULL;
+		}
+		t[n].type = rec.type;
+		memcpy(t[n].data, rec.data, sizeof(t[n].data));
+		n++;
+	}
+
+	free(buf);
+	*count = n;
+	return t;
+}
+
+/* Same steps as hori_irq_report() and hori_frame_flush() */
+static void run(const struct transfer *t, unsigned int n, struct sink *sink)
+{
+	struct hori_decoder dec;
+	uint64_t prev = 0, report;
+	int prev_valid = 0;
+	unsigned int i;
+
+	hori_decoder_init(&dec);
+
+	for (i = 0; i < n; i++) {
+		if (t[i].type == HORI_RAW_IRQ) {
+			memcpy(&report, t[i].data, sizeof(report));
+			if (prev_valid && report == prev)
+				continue;
+			prev = report;
+			prev_valid = 1;
+			hori_decode_irq(sink, t[i].data);
+		} else {
+			hori_decode_vr(&dec, sink, t[i].type,
+				       t[i].data[0] | t[i].data[1] << 8);
+		}
+	}
+}
+
+static int open_counters(int *fds)
+{
+	struct perf_event_attr attr;
+	unsigned int i;
+
+	for (i = 0; i < COUNTERS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = counters[i].config;
+		attr.disabled = !i;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+
+		fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1,
+				 i ? fds[0] : -1, 0);
+		if (fds[i] < 0) {
+			while (i--)
+				close(fds[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -c FILE  decode a capture file instead of a synthetic stream\n"
+		"  -n N     synthetic poll cycles (default 1000000)\n"
+		"  -p PCT   percent of synthetic transfers that change (default 10)\n"
+		"  -i N     passes over the stream (default 10)\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int cycles = 1000000, pct = 10, passes = 10, count = 0, i;
+	struct {
+		uint64_t	nr;
+		uint64_t	values[COUNTERS];
+	} group;
+	const char *capture = NULL;
+	struct sink sink = { 0 };
+	struct transfer *t;
+	int fds[COUNTERS], have_counters, opt;
+	uint64_t start, elapsed, total;
+
+	while ((opt = getopt(argc, argv, "c:n:p:i:")) != -1) {
+		switch (opt) {
+		case 'c': capture = optarg; break;
+		case 'n': cycles = atoi(optarg); break;
+		case 'p': pct = atoi(optarg); break;
+		case 'i': passes = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (!cycles || !passes || pct > 100)
+		usage(argv[0]);
+
+	srand(1);
+	t = capture ? load_capture(capture, &count) :
+		      synthetic(cycles, pct, &count);
+	if (!t || !count) {
+		fprintf(stderr, "no transfers to decode\n");
+		return 1;
+	}
+
+	/* Warm up caches and the branch predictor */
+	run(t, count, &sink);
+	sink.events = 0;
+
+	have_counters = !open_counters(fds);
+	if (have_counters) {
+		ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+
+	start = now_ns();
+	for (i = 0; i < passes; i++)
+		run(t, count, &sink);
+	elapsed = now_ns() - start;
+
+	if (have_counters) {
+		ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		if (read(fds[0], &group, sizeof(group)) != sizeof(group))
+			have_counters = 0;
+	}
+
+	total = (uint64_t)count * passes;
+	printf("transfers      %llu (%u x %u passes)\n",
+	       (unsigned long long)total, count, passes);
+	printf("events         %llu (%.3f per transfer, hash %llx)\n",
+	       (unsigned long long)sink.events, (double)sink.events / total,
+	       (unsigned long long)sink.hash);
+	printf("time           %.2f ns per transfer\n", (double)elapsed / total);
+
+	if (!have_counters) {
+		printf("perf counters unavailable\n");
+		return 0;
+	}
+
+	for (i = 0; i < COUNTERS; i++)
+		printf("%-14s %.2f per transfer\n", counters[i].name,
+		       (double)group.values[i] / total);
+	if (group.values[0])
+		printf("IPC            %.2f\n",
+		       (double)group.values[1] / group.values[0]);
+	if (group.values[2])
+		printf("branch misses  %.3f%%\n",
+		       100.0 * group.values[3] / group.values[2]);
+
+	return 0;
+}
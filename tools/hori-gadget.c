@@ -0,0 +1,700 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Emulated Hori/Namco Flightstick for testing hori.ko without the stick
+ *
+ * Binds to a UDC through raw_gadget, normally dummy_hcd's, so the stick
+ * shows up on the local host and hori.ko drives it over a real USB stack.
+ * It answers the VR0/VR1 vendor requests and serves interrupt reports from
+ * a scripted pattern or a capture file, and can measure how long each
+ * state change takes to come out of the stick's evdev node.
+ *
+ *	modprobe dummy_hcd raw_gadget
+ *	hori-gadget -t 10 -e /dev/input/by-id/usb-HORI_*-event-joystick
+ *
+ * Copyright (C) 2024 Daniel O'Neill <daniel@oneill.app>
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/input.h>
+#include <linux/usb/ch9.h>
+#include <linux/usb/raw_gadget.h>
+
+#define HORI_EMIT(ctx, type, code, value) do { } while (0)
+#include "../hori_report.h"
+
+#define HORI_VENDOR_ID		0x06d3
+#define HORI_PRODUCT_ID		0x0f10
+
+#define EP0_MAX			64
+#define IRQ_EP_ADDR		(USB_DIR_IN | 1)
+
+#define MAX_SAMPLES		(1 << 20)
+
+struct samples {
+	uint64_t	*ns;
+	unsigned int	count;
+};
+
+static struct samples axis_lat, trigger_lat, dpad3_lat, read_lat;
+
+/* Buttons whose latency is measured; the key code comes from hori_vr_keys */
+static const struct tracked {
+	uint8_t		vr;
+	uint8_t		bit;
+	struct samples	*lat;
+} tracked[] = {
+	{ HORI_POLL_VR0, HORI_VR0_TRIGGER,	&trigger_lat },
+	{ HORI_POLL_VR1, HORI_VR1_DPAD3_RIGHT,	&dpad3_lat },
+	{ HORI_POLL_VR1, HORI_VR1_DPAD3_MIDDLE,	&dpad3_lat },
+	{ HORI_POLL_VR1, HORI_VR1_DPAD3_LEFT,	&dpad3_lat },
+};
+
+#define TRACKED		(sizeof(tracked) / sizeof(tracked[0]))
+
+/* Emulated stick state, served to whichever request comes next */
+struct stick {
+	pthread_mutex_t	lock;
+	uint8_t		report[HORI_IRQ_REPORT_LEN];
+	uint16_t	vr[HORI_VR_COUNT];	/* active low */
+	uint64_t	reports;	/* interrupt transfers delivered */
+	uint64_t	vr_requests;
+
+	/* gadget-side change times, for matching evdev events */
+	uint64_t	x_changed[256];	/* by ABS_X value */
+	uint64_t	button_changed[TRACKED][2]; /* by tracked[] entry and value */
+};
+
+static struct stick stick = {
+	.lock	= PTHREAD_MUTEX_INITIALIZER,
+	.report	= { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0xff, 0xff },
+	.vr	= { 0xffff, 0xffff },
+};
+
+static const char *udc_driver = "dummy_udc";
+static const char *udc_device = "dummy_udc.0";
+static unsigned int rate = 500;		/* scripted changes per second */
+static unsigned int interval = 4;	/* bInterval of the interrupt endpoint */
+static unsigned int speed = 1;		/* capture replay speed, 0 = flat out */
+static unsigned int duration;		/* seconds, 0 = until killed */
+static const char *capture_path;
+static const char *evdev_path;
+
+static unsigned int irq_x;		/* report byte of ABS_X */
+
+static int fd;
+static volatile bool configured;
+static volatile bool done;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts = {
+		.tv_sec = ns / 1000000000,
+		.tv_nsec = ns % 1000000000,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static const struct usb_device_descriptor device_desc = {
+	.bLength		= USB_DT_DEVICE_SIZE,
+	.bDescriptorType	= USB_DT_DEVICE,
+	.bcdUSB			= 0x0110,
+	.bMaxPacketSize0	= EP0_MAX,
+	.idVendor		= HORI_VENDOR_ID,
+	.idProduct		= HORI_PRODUCT_ID,
+	.bcdDevice		= 0x0100,
+	.iManufacturer		= 1,
+	.iProduct		= 2,
+	.bNumConfigurations	= 1,
+};
+
+struct config_desc {
+	struct usb_config_descriptor	config;
+	struct usb_interface_descriptor	intf;
+	struct usb_endpoint_descriptor	ep;
+} __attribute__((packed));
+
+static struct config_desc config_desc = {
+	.config = {
+		.bLength		= USB_DT_CONFIG_SIZE,
+		.bDescriptorType	= USB_DT_CONFIG,
+		.wTotalLength		= sizeof(struct config_desc),
+		.bNumInterfaces		= 1,
+		.bConfigurationValue	= 1,
+		.bmAttributes		= USB_CONFIG_ATT_ONE,
+		.bMaxPower		= 50,
+	},
+	.intf = {
+		.bLength		= USB_DT_INTERFACE_SIZE,
+		.bDescriptorType	= USB_DT_INTERFACE,
+		.bNumEndpoints		= 1,
+		.bInterfaceClass	= USB_CLASS_VENDOR_SPEC,
+	},
+	.ep = {
+		.bLength		= USB_DT_ENDPOINT_SIZE,
+		.bDescriptorType	= USB_DT_ENDPOINT,
+		.bEndpointAddress	= IRQ_EP_ADDR,
+		.bmAttributes		= USB_ENDPOINT_XFER_INT,
+		.wMaxPacketSize		= HORI_IRQ_REPORT_LEN,
+	},
+};
+
+static const char *const strings[] = { NULL, "HORI", "Flightstick 2 (emulated)" };
+
+struct ep0_io {
+	struct usb_raw_ep_io	io;
+	uint8_t			data[256];
+};
+
+static int ep0_write(const void *data, unsigned int len, unsigned int max)
+{
+	struct ep0_io io = { 0 };
+
+	if (len > max)
+		len = max;
+	io.io.length = len;
+	memcpy(io.data, data, len);
+	return ioctl(fd, USB_RAW_IOCTL_EP0_WRITE, &io);
+}
+
+/* Status stage of a request without data */
+static int ep0_ack(void)
+{
+	struct ep0_io io = { 0 };
+
+	return ioctl(fd, USB_RAW_IOCTL_EP0_READ, &io);
+}
+
+static int ep0_string(unsigned int index, unsigned int max)
+{
+	uint8_t buf[2 + 2 * 64];
+	unsigned int i, len;
+
+	if (!index) {
+		const uint8_t langid[] = { 4, USB_DT_STRING, 0x09, 0x04 };
+
+		return ep0_write(langid, sizeof(langid), max);
+	}
+	if (index >= sizeof(strings) / sizeof(strings[0]))
+		return -1;
+
+	len = strlen(strings[index]);
+	buf[0] = 2 + 2 * len;
+	buf[1] = USB_DT_STRING;
+	for (i = 0; i < len; i++) {
+		buf[2 + 2 * i] = strings[index][i];
+		buf[3 + 2 * i] = 0;
+	}
+
+	return ep0_write(buf, buf[0], max);
+}
+
+static int ep0_standard(const struct usb_ctrlrequest *ctrl)
+{
+	unsigned int max = ctrl->wLength;
+	static const uint8_t zero[2];
+	int ep;
+
+	switch (ctrl->bRequest) {
+	case USB_REQ_GET_DESCRIPTOR:
+		switch (ctrl->wValue >> 8) {
+		case USB_DT_DEVICE:
+			return ep0_write(&device_desc, sizeof(device_desc), max);
+		case USB_DT_CONFIG:
+			return ep0_write(&config_desc, sizeof(config_desc), max);
+		case USB_DT_STRING:
+			return ep0_string(ctrl->wValue & 0xff, max);
+		}
+		return -1;
+	case USB_REQ_SET_CONFIGURATION:
+		if (!configured) {
+			ep = ioctl(fd, USB_RAW_IOCTL_EP_ENABLE, &config_desc.ep);
+			if (ep < 0)
+				die("USB_RAW_IOCTL_EP_ENABLE");
+			ioctl(fd, USB_RAW_IOCTL_VBUS_DRAW, config_desc.config.bMaxPower);
+			if (ioctl(fd, USB_RAW_IOCTL_CONFIGURE, 0) < 0)
+				die("USB_RAW_IOCTL_CONFIGURE");
+			configured = true;
+		}
+		return ep0_ack();
+	case USB_REQ_GET_STATUS:
+		return ep0_write(zero, sizeof(zero), max);
+	case USB_REQ_GET_INTERFACE:
+	case USB_REQ_GET_CONFIGURATION:
+		return ep0_write(zero, 1, max);
+	case USB_REQ_SET_INTERFACE:
+	case USB_REQ_CLEAR_FEATURE:
+		return ep0_ack();
+	}
+
+	return -1;
+}
+
+/* VR0/VR1, as sent by hori_poll_vr(): IN, vendor, endpoint, wIndex 1 */
+static int ep0_vendor(const struct usb_ctrlrequest *ctrl)
+{
+	uint8_t word[2];
+
+	if (!(ctrl->bRequestType & USB_DIR_IN) || ctrl->bRequest > HORI_POLL_VR1)
+		return -1;
+
+	pthread_mutex_lock(&stick.lock);
+	word[0] = stick.vr[ctrl->bRequest];
+	word[1] = stick.vr[ctrl->bRequest] >> 8;
+	stick.vr_requests++;
+	pthread_mutex_unlock(&stick.lock);
+
+	return ep0_write(word, sizeof(word), ctrl->wLength);
+}
+
+static void *ep0_loop(void *arg)
+{
+	struct {
+		struct usb_raw_event	event;
+		struct usb_ctrlrequest	ctrl;
+	} ev;
+	int error;
+
+	while (!done) {
+		memset(&ev, 0, sizeof(ev));
+		ev.event.length = sizeof(ev.ctrl);
+		if (ioctl(fd, USB_RAW_IOCTL_EVENT_FETCH, &ev) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("USB_RAW_IOCTL_EVENT_FETCH");
+		}
+		if (ev.event.type != USB_RAW_EVENT_CONTROL)
+			continue;
+
+		switch (ev.ctrl.bRequestType & USB_TYPE_MASK) {
+		case USB_TYPE_STANDARD:
+			error = ep0_standard(&ev.ctrl);
+			break;
+		case USB_TYPE_VENDOR:
+			error = ep0_vendor(&ev.ctrl);
+			break;
+		default:
+			error = -1;
+			break;
+		}
+		if (error < 0)
+			ioctl(fd, USB_RAW_IOCTL_EP0_STALL, 0);
+	}
+
+	return NULL;
+}
+
+/* Blocks until the host polls, so this runs at the endpoint's rate */
+static void *irq_loop(void *arg)
+{
+	struct {
+		struct usb_raw_ep_io	io;
+		uint8_t			data[HORI_IRQ_REPORT_LEN];
+	} io = { .io.length = HORI_IRQ_REPORT_LEN };
+
+	while (!configured && !done)
+		usleep(1000);
+
+	while (!done) {
+		pthread_mutex_lock(&stick.lock);
+		memcpy(io.data, stick.report, HORI_IRQ_REPORT_LEN);
+		pthread_mutex_unlock(&stick.lock);
+
+		if (ioctl(fd, USB_RAW_IOCTL_EP_WRITE, &io) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("USB_RAW_IOCTL_EP_WRITE");
+			break;
+		}
+
+		pthread_mutex_lock(&stick.lock);
+		stick.reports++;
+		pthread_mutex_unlock(&stick.lock);
+	}
+
+	return NULL;
+}
+
+/* Records when tracked[] button @t changed to its state in @word */
+static void button_changed(unsigned int t, uint16_t word)
+{
+	stick.button_changed[t][!(word & 1 << tracked[t].bit)] = now_ns();
+}
+
+/* Toggles tracked[] button @t; called with stick.lock held */
+static void button_flip(unsigned int t)
+{
+	stick.vr[tracked[t].vr] ^= 1 << tracked[t].bit;
+	button_changed(t, stick.vr[tracked[t].vr]);
+}
+
+/*
+ * Moves the X axis to a new value every tick. Every eighth tick flips the
+ * trigger (VR0), and four ticks later one of the d-pad 3 buttons (VR1),
+ * each pressed and released before moving on to the next. Every change
+ * is visible as one evdev event.
+ */
+static void script_loop(void)
+{
+	uint64_t next = now_ns(), period = 1000000000 / rate;
+	unsigned int tick = 0;
+
+	while (!done) {
+		next += period;
+		sleep_until(next);
+		tick++;
+
+		pthread_mutex_lock(&stick.lock);
+		stick.report[irq_x] = tick & 0xff;
+		stick.x_changed[tick & 0xff] = now_ns();
+		if (tick % 8 == 0)
+			button_flip(0);
+		else if (tick % 8 == 4)
+			button_flip(1 + tick / 16 % (TRACKED - 1));
+		pthread_mutex_unlock(&stick.lock);
+	}
+}
+
+/* Plays a capture file back into the emulated state, then loops it */
+static void capture_loop(void)
+{
+	static uint8_t buf[1 << 16];
+	struct hori_capture_state cap;
+	struct hori_raw_record rec;
+	uint64_t start = 0, first = 0;
+	unsigned int len, off;
+	bool started;
+	int in, used;
+	ssize_t n;
+
+	in = open(capture_path, O_RDONLY);
+	if (in < 0)
+		die(capture_path);
+
+	while (!done) {
+		if (lseek(in, 0, SEEK_SET) < 0)
+			die("lseek");
+		n = read(in, buf, HORI_CAPTURE_MAGIC_LEN);
+		if (n != HORI_CAPTURE_MAGIC_LEN ||
+		    memcmp(buf, HORI_CAPTURE_MAGIC, HORI_CAPTURE_MAGIC_LEN)) {
+			fprintf(stderr, "%s: not a capture file\n", capture_path);
+			exit(1);
+		}
+
+		memset(&cap, 0, sizeof(cap));
+		started = false;
+		len = 0;
+		while (!done && (n = read(in, buf + len, sizeof(buf) - len)) > 0) {
+			len += n;
+			for (off = 0; !done; off += used) {
+				used = hori_capture_decode(&cap, buf + off,
+							   len - off, &rec);
+				if (used < 0) {
+					fprintf(stderr, "%s: corrupt\n", capture_path);
+					exit(1);
+				}
+				if (!used)
+					break;
+				if (rec.type == HORI_CAPTURE_GAP)
+					continue;
+
+				if (!started) {
+					started = true;
+					start = now_ns();
+					first = rec.time_ns;
+				} else if (speed && rec.time_ns > first) {
+					sleep_until(start + (rec.time_ns - first) / speed);
+				}
+
+				pthread_mutex_lock(&stick.lock);
+				if (rec.type == HORI_RAW_IRQ && rec.len == HORI_IRQ_REPORT_LEN) {
+					if (stick.report[irq_x] != rec.data[irq_x])
+						stick.x_changed[rec.data[irq_x]] = now_ns();
+					memcpy(stick.report, rec.data, HORI_IRQ_REPORT_LEN);
+				} else if (rec.type != HORI_RAW_IRQ && rec.len == 2) {
+					uint16_t word = rec.data[0] | rec.data[1] << 8;
+					unsigned int t;
+
+					for (t = 0; t < TRACKED; t++)
+						if (tracked[t].vr == rec.type &&
+						    (word ^ stick.vr[rec.type]) & 1 << tracked[t].bit)
+							button_changed(t, word);
+					stick.vr[rec.type] = word;
+				}
+				pthread_mutex_unlock(&stick.lock);
+			}
+			memmove(buf, buf + off, len - off);
+			len -= off;
+		}
+	}
+
+	close(in);
+}
+
+static void sample(struct samples *s, int64_t ns)
+{
+	if (ns >= 0 && s->count < MAX_SAMPLES)
+		s->ns[s->count++] = ns;
+}
+
+/* Matches evdev events to the gadget-side change that caused them */
+static void *evdev_loop(void *arg)
+{
+	struct input_event ev[64];
+	int clock = CLOCK_MONOTONIC;
+	struct samples *lat;
+	uint64_t t, changed, now;
+	unsigned int k;
+	int in, i, n;
+
+	in = open(evdev_path, O_RDONLY);
+	if (in < 0)
+		die(evdev_path);
+	if (ioctl(in, EVIOCSCLOCKID, &clock) < 0)
+		die("EVIOCSCLOCKID");
+
+	while (!done) {
+		n = read(in, ev, sizeof(ev));
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			die("read");
+		}
+		now = now_ns();
+
+		for (i = 0; i < n / (int)sizeof(ev[0]); i++) {
+			t = ev[i].input_event_sec * 1000000000ULL +
+			    ev[i].input_event_usec * 1000ULL;
+
+			changed = 0;
+			lat = NULL;
+			pthread_mutex_lock(&stick.lock);
+			if (ev[i].type == EV_ABS && ev[i].code == ABS_X) {
+				changed = stick.x_changed[ev[i].value & 0xff];
+				lat = &axis_lat;
+			} else if (ev[i].type == EV_KEY) {
+				for (k = 0; k < TRACKED; k++) {
+					if (hori_vr_keys[tracked[k].vr][tracked[k].bit] !=
+					    ev[i].code)
+						continue;
+					changed = stick.button_changed[k][!!ev[i].value];
+					lat = tracked[k].lat;
+				}
+			}
+			pthread_mutex_unlock(&stick.lock);
+
+			if (ev[i].type == EV_SYN)
+				sample(&read_lat, now - t);
+			if (changed)
+				sample(lat, t - changed);
+		}
+	}
+
+	close(in);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void print_samples(const char *name, struct samples *s)
+{
+	static const double pct[] = { 50, 90, 99, 99.9 };
+	unsigned int i;
+
+	if (!s->count) {
+		printf("%-8s no samples\n", name);
+		return;
+	}
+
+	qsort(s->ns, s->count, sizeof(*s->ns), cmp_u64);
+	printf("%-8s n=%-8u", name, s->count);
+	for (i = 0; i < sizeof(pct) / sizeof(pct[0]); i++)
+		printf(" p%g=%.1fus", pct[i],
+		       s->ns[(unsigned int)(s->count * pct[i] / 100)] / 1000.0);
+	printf(" max=%.1fus\n", s->ns[s->count - 1] / 1000.0);
+}
+
+/* Busy CPU time of the whole machine, in ns */
+static uint64_t cpu_busy_ns(void)
+{
+	unsigned long long user, nice, sys, idle, iowait, irq, softirq;
+	FILE *f = fopen("/proc/stat", "r");
+	int n;
+
+	if (!f)
+		return 0;
+	n = fscanf(f, "cpu %llu %llu %llu %llu %llu %llu %llu",
+		   &user, &nice, &sys, &idle, &iowait, &irq, &softirq);
+	fclose(f);
+	if (n != 7)
+		return 0;
+
+	return (user + nice + sys + irq + softirq) *
+	       (1000000000ULL / sysconf(_SC_CLK_TCK));
+}
+
+static uint64_t self_ns(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL +
+	       (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+static void stop(int sig)
+{
+	done = true;
+}
+
+static void *stop_after(void *arg)
+{
+	sleep(duration);
+	done = true;
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -d DRIVER  UDC driver (default dummy_udc)\n"
+		"  -u DEVICE  UDC instance (default dummy_udc.0)\n"
+		"  -i N       interrupt endpoint bInterval (default 4)\n"
+		"  -r HZ      scripted state changes per second (default 500)\n"
+		"  -c FILE    replay a capture file instead of the script\n"
+		"  -s N       capture replay speed, 0 = flat out (default 1)\n"
+		"  -e EVDEV   measure change-to-event latency on this node\n"
+		"  -t SEC     stop after SEC seconds and print results\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct usb_raw_init init = { .speed = USB_SPEED_FULL };
+	pthread_t ep0, irq, evdev, timer;
+	uint64_t busy, self, reports;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:u:i:r:c:s:e:t:")) != -1) {
+		switch (opt) {
+		case 'd': udc_driver = optarg; break;
+		case 'u': udc_device = optarg; break;
+		case 'i': interval = atoi(optarg); break;
+		case 'r': rate = atoi(optarg); break;
+		case 'c': capture_path = optarg; break;
+		case 's': speed = atoi(optarg); break;
+		case 'e': evdev_path = optarg; break;
+		case 't': duration = atoi(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (!rate || !interval || interval > 255)
+		usage(argv[0]);
+	while (hori_irq_axes[irq_x] != ABS_X)
+		irq_x++;
+	config_desc.ep.bInterval = interval;
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	axis_lat.ns = calloc(MAX_SAMPLES, sizeof(uint64_t));
+	trigger_lat.ns = calloc(MAX_SAMPLES, sizeof(uint64_t));
+	dpad3_lat.ns = calloc(MAX_SAMPLES, sizeof(uint64_t));
+	read_lat.ns = calloc(MAX_SAMPLES, sizeof(uint64_t));
+	if (!axis_lat.ns || !trigger_lat.ns || !dpad3_lat.ns || !read_lat.ns)
+		die("calloc");
+
+	fd = open("/dev/raw-gadget", O_RDWR);
+	if (fd < 0)
+		die("/dev/raw-gadget");
+
+	strncpy((char *)init.driver_name, udc_driver, UDC_NAME_LENGTH_MAX - 1);
+	strncpy((char *)init.device_name, udc_device, UDC_NAME_LENGTH_MAX - 1);
+	if (ioctl(fd, USB_RAW_IOCTL_INIT, &init) < 0)
+		die("USB_RAW_IOCTL_INIT");
+	if (ioctl(fd, USB_RAW_IOCTL_RUN, 0) < 0)
+		die("USB_RAW_IOCTL_RUN");
+
+	pthread_create(&ep0, NULL, ep0_loop, NULL);
+	pthread_create(&irq, NULL, irq_loop, NULL);
+	if (evdev_path)
+		pthread_create(&evdev, NULL, evdev_loop, NULL);
+	if (duration)
+		pthread_create(&timer, NULL, stop_after, NULL);
+
+	while (!configured && !done)
+		usleep(1000);
+	if (!configured)
+		return 1;
+	/* Let hori.ko bind and the evdev reader open before measuring */
+	sleep(1);
+
+	busy = cpu_busy_ns();
+	self = self_ns();
+	pthread_mutex_lock(&stick.lock);
+	reports = stick.reports;
+	pthread_mutex_unlock(&stick.lock);
+
+	if (capture_path)
+		capture_loop();
+	else
+		script_loop();
+
+	busy = cpu_busy_ns() - busy;
+	self = self_ns() - self;
+	pthread_mutex_lock(&stick.lock);
+	reports = stick.reports - reports;
+	pthread_mutex_unlock(&stick.lock);
+
+	printf("reports  %llu, vendor requests %llu\n",
+	       (unsigned long long)reports,
+	       (unsigned long long)stick.vr_requests);
+	if (reports && busy > self)
+		printf("cpu      %.2fus per report outside the emulator (%.2fus in it)\n",
+		       (busy - self) / 1000.0 / reports,
+		       self / 1000.0 / reports);
+	print_samples("axis", &axis_lat);
+	print_samples("trigger", &trigger_lat);
+	print_samples("dpad3", &dpad3_lat);
+	print_samples("read", &read_lat);
+
+	/* The ep0 and evdev threads sit in blocking calls; exit takes them */
+	return 0;
+}